@@ -5,7 +5,33 @@
 #include <set>
 #include <stack>
 #include <queue>
+#include <deque>
+#include <list>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <fstream>
+#include <chrono>
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include <unordered_map>
 #include <algorithm>
+#include <iterator>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
 
 /**
  * @brief The workflow of Regex to DFS is as follows:
@@ -17,661 +43,5200 @@
  * 
  */
 
-struct DNode{
+struct NDNode{
     int id;
-    std::map<char, DNode*> next;
-    DNode(int id){
+    std::map<char, std::vector<NDNode*>> next;
+    // Epsilon transitions, kept apart from next so that every byte value can label a transition
+    std::vector<NDNode*> epsilon;
+
+    NDNode(int id){
         this->id = id;
     }
-    DNode(int id, std::map<char, DNode*> next){
-        this->id;
-        this->next = next;
-    }
 };
 
-struct NDNode{
-    int id;
-    std::map<char, std::vector<NDNode*>> next;
+/// @brief Partial NFA built by the thompson_* helpers of FA, one start node and one end node
+struct NDFragment{
+    NDNode* start;
+    NDNode* end;
+};
 
-    std::set<NDNode*> null_transition(char nullchar, char input){
-        std::set<NDNode*> result;
-        std::stack<std::pair<NDNode*, bool>> S;
-        // result.insert(this);
-        S.push({this, false});
-        while(!S.empty()){
-            std::pair<NDNode*, bool> state = S.top(); S.pop();
-            NDNode *node = state.first;
-            bool charUsed = state.second;
-            if(result.find(node) == result.end()){
-                result.insert(node);
-                if(node->next.count(nullchar) > 0){
-                    for(auto &null_next: node->next[nullchar]){
-                        if(result.find(null_next) == result.end()){
-                            S.push({null_next, false});
-                        }
-                    }
-                }
+/// @brief Fixed-size bitset over densely numbered NFA states
+struct StateSet{
+    std::vector<uint64_t> bits;
 
-                if(!charUsed){
-                    for(auto& next: node->next[input]){
-                        if(result.find(next) == result.end()){
-                            S.push({next, true});
-                        }
-                    }
-                }
-            }
+    StateSet(){
+    }
+    StateSet(int n){
+        this->bits.assign((n + 63)/64, 0);
+    }
+
+    void insert(int i){
+        bits[i >> 6] |= (uint64_t)1 << (i & 63);
+    }
+
+    bool contains(int i) const{
+        return (bits[i >> 6] >> (i & 63)) & 1;
+    }
+
+    void merge(const StateSet &other){
+        int sz = bits.size();
+        for(int i = 0; i<sz; i++){
+            bits[i] |= other.bits[i];
         }
+    }
 
-        return result;
+    bool intersects(const StateSet &other) const{
+        int sz = bits.size();
+        for(int i = 0; i<sz; i++){
+            if(bits[i] & other.bits[i]) return true;
+        }
+        return false;
     }
 
-    // return the null-closure of current node
-    std::vector<NDNode*> epsilon_closure(char nullchar){
-        std::set<NDNode*> visited;
-        std::stack<NDNode*> closure;
-        closure.push(this);
-        std::vector<NDNode*> result;
-        while(!closure.empty()){
-            NDNode* node = closure.top();
-            closure.pop();
-            if(visited.find(node) == visited.end()){
-                visited.insert(node);
-                for(auto& next_node : node->next[nullchar]){
-                    closure.push(next_node);
-                }
-            }
+    bool empty() const{
+        for(auto& w: bits){
+            if(w) return false;
         }
+        return true;
+    }
 
-        return std::vector<NDNode*>(visited.begin(), visited.end());
+    void clear(){
+        std::fill(bits.begin(), bits.end(), 0);
+    }
 
+    bool operator==(const StateSet &other) const{
+        return bits == other.bits;
     }
 
-    NDNode(int id){
-        this->id = id;
+    size_t hash() const{
+        uint64_t h = 0x9e3779b97f4a7c15ULL;
+        for(auto& w: bits){
+            h ^= w + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        }
+        return h;
     }
-    NDNode(int id, std::map<char, std::vector<NDNode*>> next){
-        this->id = id;
-        this->next = next;
+
+    /// @brief Calls f(i) for every state i in the set, in increasing order
+    template<typename F>
+    void for_each(F f) const{
+        int sz = bits.size();
+        for(int i = 0; i<sz; i++){
+            uint64_t w = bits[i];
+            while(w){
+                f(i*64 + __builtin_ctzll(w));
+                w &= w - 1;
+            }
+        }
+    }
+};
+
+struct StateSetHash{
+    size_t operator()(const StateSet &s) const{
+        return s.hash();
     }
 };
 
 class Machine{
     public:
+        virtual ~Machine(){
+        }
     virtual void print_machine_table() = 0;
-    virtual bool accepted(const std::string &s) = 0;
+    /// @brief Must not modify the machine in a way visible to other threads, FA calls it concurrently
+    virtual bool accepted(const std::string &s) const = 0;
 };
 
+/// @brief DFA compiled into one contiguous transition table.
+/// Bytes are first mapped to a column (class) through byte_class, then the next state is table[state * num_classes + class].
+/// Class 0 holds every byte outside the alphabet and always leads to the dead state, so no separate validation pass is needed.
 class DMachine: public Machine{
     public:
+        static const uint32_t NO_STATE = 0xffffffff;
+        // Strings advanced together by accepted_interleaved() in batch matching, and the average string length
+        // from which batch matching uses it
+        static const int LANES = 8;
+        static const size_t INTERLEAVE_MIN_LENGTH = 16;
+        // Bytes between two looks of run() at the exits of the current state, and the most exit bytes it scans for
+        static const size_t EXIT_CHECK_INTERVAL = 32;
+        static const int MAX_EXIT_BYTES = 3;
+
+        /// @brief The bytes leaving a state, every other byte loops back to it
+        /// count is 0 for an absorbing state (the dead state, or a final state accepting any suffix) and -1 when
+        /// more than MAX_EXIT_BYTES bytes leave.
+        struct StateExits{
+            int count;
+            unsigned char bytes[MAX_EXIT_BYTES];
+        };
+
         std::string alphabet;
-        std::set<DNode*> final_states;
-        DNode* start;
-        DNode* end;
+        uint8_t byte_class[256];
+        int num_classes;
+        int num_states;
+        uint32_t start;
+        uint32_t dead;
+        std::vector<uint32_t> table;
+        std::vector<uint64_t> final_states;
+        // Transition table and final-state bitmap read by the matcher. They point into table and final_states for a
+        // constructed machine, or into the file mapping held by mapping for a loaded one (see FA::load)
+        const uint32_t *trans;
+        const uint64_t *accept;
+        size_t table_size;
+        std::shared_ptr<const void> mapping;
+        // Multi-pattern DFAs label every state with the patterns it accepts: state_label[q] indexes label_sets, and
+        // label 0 is the empty set. Both are empty for a single pattern.
+        std::vector<uint32_t> state_label;
+        std::vector<std::vector<int>> label_sets;
+        // Exits of every state, see mark_exits(). Empty for a loaded machine that was not verified, which run()
+        // then matches byte by byte.
+        std::vector<StateExits> exits;
 
-        /// @brief First state is the starting state, states begining with * are final states.
-        void print_machine_table(){
+        DMachine(){
 
-            std::cout << "States starting with * are final states" << std::endl;
-            std::cout << "Starting state is " << start->id << std::endl;
-            std::cout << std::endl;
-            int sz = alphabet.size();
-            std::set<DNode*> visited;
-            std::stack<DNode*> S;
-            S.push(start);
-            while(!S.empty()){
-                DNode* node = S.top(); S.pop();
-                if(visited.find(node) == visited.end()){
-                    //Final states start with *
-                    if(final_states.find(node) != final_states.end()){
-                        std::cout << "*";
-                    }
-                    visited.insert(node);
-                    std::cout << node->id << "\t=>\t";
-                    for(int i = 0; i<sz; i++){
-                        DNode* next = node->next[alphabet[i]];
-                        std::cout << alphabet[i] << ":" << next->id << "\t";
-                        if(visited.find(next) == visited.end()){
-                            S.push(next);
-                        }
-                    }
-                    std::cout << std::endl;
-                }
-            }
-            std::cout << std::endl;
         }
 
-        bool accepted(const std::string &s) {
+        // trans and accept may point into this machine's own vectors, so it is never copied
+        DMachine(const DMachine &other) = delete;
+        DMachine& operator=(const DMachine &other) = delete;
 
-            for(auto& c: s){
-                bool check = std::binary_search(alphabet.begin(), alphabet.end(), c);
-                if(!check){
-                    std::cerr << "Input string has non-alphabet: " << s << std::endl;
-                    return false;
-                }
-            }
+        /// @brief Points the matcher at table and final_states, called whenever they are rebuilt
+        void bind(){
+            trans = table.data();
+            accept = final_states.data();
+            table_size = table.size();
+            mark_exits();
+        }
 
-            DNode* t = start;
-            int sz = s.size();
-            for(int i = 0; i<sz; i++){
-                t = t->next[s[i]];
+        /// @brief Whether state q goes back to itself on every class
+        bool absorbing(uint32_t q) const{
+            for(int c = 0; c<num_classes; c++){
+                if(trans[q*num_classes + c] != q) return false;
             }
+            return true;
+        }
 
-            bool isFinal = (final_states.find(t) != final_states.end());
-            if(isFinal){
-                return true;
+        /// @brief Fills exits from the transition table
+        void mark_exits(){
+            int class_size[256] = {0};
+            for(int b = 0; b<256; b++){
+                class_size[byte_class[b]]++;
+            }
+            exits.assign(num_states, StateExits());
+            for(uint32_t q = 0; q<(uint32_t)num_states; q++){
+                StateExits &e = exits[q];
+                int leaving = 0;
+                for(int c = 0; c<num_classes && leaving <= MAX_EXIT_BYTES; c++){
+                    if(trans[q*num_classes + c] != q) leaving += class_size[c];
+                }
+                e.count = (leaving <= MAX_EXIT_BYTES) ? 0 : -1;
+                for(int b = 0; b<256 && leaving > 0 && e.count >= 0; b++){
+                    if(trans[q*num_classes + byte_class[b]] != q) e.bytes[e.count++] = b;
+                }
             }
-            
-            return false;
         }
 
-        std::vector<int> trace_states(const std::string &s){
-            for(auto& c: s){
-                bool check = std::binary_search(alphabet.begin(), alphabet.end(), c);
-                if(!check){
-                    std::cerr << "Input string has non-alphabet: " << s << std::endl;
-                    return {};
+        /// @brief Position of the first exit byte of e in [i, len) of s, len if there is none
+        static size_t find_exit(const StateExits &e, const char *s, size_t i, size_t len){
+            if(e.count == 1){
+                const void *found = memchr(s + i, e.bytes[0], len - i);
+                return found ? (const char*)found - s : len;
+            }
+#if defined(__AVX2__) || defined(__SSE2__)
+            // 16 bytes compared at once against every exit byte, the last one repeated when there are only two
+            const __m128i b0 = _mm_set1_epi8(e.bytes[0]);
+            const __m128i b1 = _mm_set1_epi8(e.bytes[1]);
+            const __m128i b2 = _mm_set1_epi8(e.bytes[e.count - 1]);
+            for(; i + 16<=len; i += 16){
+                __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+                __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, b0), _mm_cmpeq_epi8(v, b1)), _mm_cmpeq_epi8(v, b2));
+                int mask = _mm_movemask_epi8(hit);
+                if(mask != 0){
+                    return i + __builtin_ctz(mask);
                 }
             }
-            std::vector<int> result;
-            DNode* t = start;
-
-            result.push_back(t->id);
-            int sz = s.size();
-            for(int i = 0; i<sz; i++){
-                t = t->next[s[i]];
-                result.push_back(t->id);
+#endif
+            for(; i<len; i++){
+                for(int k = 0; k<e.count; k++){
+                    if((unsigned char)s[i] == e.bytes[k]) return i;
+                }
             }
-
-            return result;
+            return len;
         }
-};
-
-class NDMachine: public Machine{
-
-    public:
-        std::string alphabet;
-        char nullchar;
-        std::set<NDNode*> final_states;
-        NDNode* start;
-        NDNode* end;
-
-
-        void print_machine_table(){
 
+        bool is_final(uint32_t state) const{
+            return (accept[state >> 6] >> (state & 63)) & 1;
         }
 
-        bool accepted(const std::string &s){
-            return false;
+        /// @brief Label of state, states with different labels accept differently
+        /// Without pattern labels it is 1 for final states and 0 otherwise.
+        uint32_t label(uint32_t state) const{
+            return state_label.empty() ? is_final(state) : state_label[state];
         }
-};
-
-void DBG_print(const std::set<NDNode*> &state){
-    std::cerr << "(";
-    for(auto& e: state){
-        std::cerr << e->id << ",";
-    }
-    std::cerr << ") ";
-}
 
-void DBG_table(const std::map<std::set<NDNode*>, std::vector<std::set<NDNode*>>> &table){
-    for(auto& row: table){
-        DBG_print(row.first);
-        std::cerr << " :: ";
-        for(auto& s: row.second){
-            DBG_print(s);
-            std::cerr << ", ";
+        size_t num_labels() const{
+            return state_label.empty() ? 2 : label_sets.size();
         }
-        std::cerr << std::endl;
-    }
-}
-
-class FA{
 
-    private:
-        NDMachine *ndm;
-        DMachine *dm;
-        std::string alphabet;
-        std::string regex;
-        char nullchar;
-        int nd_state_id;
-        int d_state_id;
-
-        /// @brief Performs Union operation according to thompson's rule
-        /// @param a NDMachine A
-        /// @param b NDMachine B
-        /// @return returns new NDMachine with +2 states and +4 null transistions => (A+B)
-        NDMachine* thompson_union(NDMachine *a, NDMachine *b){
-            NDMachine *machine = new NDMachine();
-
-            NDNode *q0, *q1;
-            q0 = new NDNode(nd_state_id++);
-            q1 = new NDNode(nd_state_id++);
-
-            q0->next[nullchar].push_back(a->start);
-            q0->next[nullchar].push_back(b->start);
-            a->end->next[nullchar].push_back(q1);
-            b->end->next[nullchar].push_back(q1);
-
-            machine->start = q0;
-            machine->end = q1;
-            machine->final_states.insert(q1);
-            machine->alphabet = this->alphabet;
-            machine->nullchar = nullchar;
-            return machine;
+        /// @brief Bytes held by the transition table, final states and labels
+        size_t memory_bytes() const{
+            size_t bytes = table_size*sizeof(uint32_t) + ((size_t)num_states + 63)/64*sizeof(uint64_t);
+            bytes += state_label.size()*sizeof(uint32_t) + exits.size()*sizeof(StateExits);
+            for(auto& set: label_sets){
+                bytes += sizeof(set) + set.size()*sizeof(int);
+            }
+            return bytes;
         }
 
-        /// @brief Performs Kleene-closure according to thompson's rule
-        /// @param a Kleene-closure of a
-        /// @return returns new NDMachine with +2 states and +4 null transitions => (a*)
-        NDMachine* thompson_kleene_closure(NDMachine *a){
-            NDMachine *machine = new NDMachine();
-
-            NDNode *q0, *q1;
-            q0 = new NDNode(nd_state_id++);
-            q1 = new NDNode(nd_state_id++);
-
-            q0->next[nullchar].push_back(a->start);
-            a->end->next[nullchar].push_back(q1);
-            a->end->next[nullchar].push_back(a->start);
-            q0->next[nullchar].push_back(q1);
-
-            machine->start = q0;
-            machine->end = q1;
-            machine->final_states.insert(q1);
-            machine->alphabet = this->alphabet;
-            machine->nullchar = nullchar;
-            return machine;
+        /// @brief Ids of the patterns accepted in state, for a multi-pattern DFA
+        const std::vector<int>& patterns(uint32_t state) const{
+            return label_sets[state_label[state]];
         }
 
-        /// @brief Performs concatenation operation according to thompson's rule
-        /// @param a NDMachine A
-        /// @param b NDMacine B
-        /// @return returns new NDMachine with +1 null transition => (AB)
-        NDMachine* thompson_concatenate(NDMachine *a, NDMachine *b){
-            NDMachine *machine = new NDMachine();
-            
-            NDNode* a_end = a->end, *b_start = b->start;
-            a_end->next[nullchar].push_back(b_start);
-
-            machine->start = a->start;
-            machine->end = b->end;
-            machine->final_states.insert(b->end);
-            machine->alphabet = this->alphabet;
-            machine->nullchar = this->nullchar;
-
-            return machine;
+        /// @brief First state is the starting state, states begining with * are final states.
+        void print_machine_table(){
 
+            std::cout << "States starting with * are final states" << std::endl;
+            std::cout << "Starting state is " << start << std::endl;
+            std::cout << std::endl;
+            int sz = alphabet.size();
+            for(int state = 0; state<num_states; state++){
+                //Final states start with *
+                if(is_final(state)){
+                    std::cout << "*";
+                }
+                std::cout << state << "\t=>\t";
+                for(int i = 0; i<sz; i++){
+                    uint32_t next = trans[state*num_classes + byte_class[(unsigned char)alphabet[i]]];
+                    std::cout << alphabet[i] << ":" << next << "\t";
+                }
+                std::cout << std::endl;
+            }
+            std::cout << std::endl;
         }
 
-        /// @brief Converts char data-type to NDMachine
-        /// @param c Transition character
-        /// @return returns NDMachine with 2 states and 1 transition => (q0 -c-> q1)
-        NDMachine* token_to_machine(char c){
-            NDMachine *machine = new NDMachine();
-            NDNode *q0, *q1;
-            q0 = new NDNode(nd_state_id++);
-            q1 = new NDNode(nd_state_id++);
-
-            q0->next[c].push_back(q1);
+        bool accepted(const std::string &s) const{
+            return accepted(s.data(), s.size());
+        }
 
-            machine->start = q0;
-            machine->end = q1;
-            machine->final_states.insert(q1);
-            machine->alphabet = this->alphabet;
-            machine->nullchar = this->nullchar;
-            return machine;
+        bool accepted(const char *s, size_t len) const{
+            return is_final(run(start, s, len));
         }
 
-        /// @brief Apply thompson's rule step-wise based on post-fix notation of Regex
-        void construct_NFA(){
-            int sz = regex.size();
-            std::stack<NDMachine*> M;
-            std::string ops = "+*.";
-            for(int i = 0; i<sz; i++){
-                int isOps = -1;
-                for(int j = 0; j<3; j++){
-                    if(regex[i] == ops[j]){
-                        isOps = j;
-                        break;
+        /// @brief Matches the strings get(i) = (pointer, length) for i in [begin, end), LANES of them at once
+        /// The lookups of different strings do not depend on each other, so interleaving them hides the load
+        /// latency that bounds the one-string loop. All lanes advance together by the length left in the shortest
+        /// one, then finished lanes report put(i, accepted) and are refilled with the next string. Once no string
+        /// is left to refill with, the remaining lanes finish one by one.
+        template<int L, typename Get, typename Put>
+        void accepted_interleaved(size_t begin, size_t end, Get get, Put put) const{
+            const char *ptr[L];
+            size_t left[L], index[L];
+            uint32_t state[L];
+            size_t next = begin;
+
+            // Fill lane l with the next non-empty string, false if there is none
+            auto refill = [&](int l){
+                while(next < end){
+                    std::pair<const char*, size_t> record = get(next);
+                    if(record.second == 0){
+                        put(next++, is_final(start));
+                        continue;
                     }
+                    ptr[l] = record.first;
+                    left[l] = record.second;
+                    index[l] = next++;
+                    state[l] = start;
+                    return true;
                 }
+                return false;
+            };
 
-                if(isOps == 0){
-                    NDMachine *rm = M.top(); M.pop();
-                    NDMachine *lm = M.top(); M.pop();
-                    NDMachine *machine = thompson_union(lm, rm);
-                    M.push(machine);
+            int filled = 0;
+            while(filled < L && refill(filled)){
+                filled++;
+            }
+            bool full = (filled == L);
+            while(full){
+                size_t step = left[0];
+                for(int l = 1; l<L; l++){
+                    step = std::min(step, left[l]);
                 }
-                else if(isOps == 1){
-                    NDMachine *m = M.top(); M.pop();
-                    NDMachine *machine = thompson_kleene_closure(m);
-                    M.push(machine);
+                // Lanes stuck in an absorbing state are done, the step is bounded so they are found early
+                if(!exits.empty()){
+                    step = std::min(step, EXIT_CHECK_INTERVAL);
                 }
-                else if(isOps == 2){
-                    NDMachine *rm = M.top(); M.pop();
-                    NDMachine *lm = M.top(); M.pop();
-                    NDMachine *machine = thompson_concatenate(lm, rm);
-                    M.push(machine);
+                advance<L>(state, ptr, step);
+                for(int l = 0; l<L; l++){
+                    ptr[l] += step;
+                    left[l] -= step;
+                    if(left[l] == 0 || (!exits.empty() && exits[state[l]].count == 0)){
+                        put(index[l], is_final(state[l]));
+                        if(!refill(l)){
+                            // out of strings, lanes still running are finished below
+                            left[l] = 0;
+                            full = false;
+                        }
+                    }
                 }
-                else{
-                    NDMachine *machine = token_to_machine(regex[i]);
-                    M.push(machine);
+            }
+            for(int l = 0; l<filled; l++){
+                if(left[l] > 0){
+                    put(index[l], is_final(run(state[l], ptr[l], left[l])));
                 }
             }
-
-            NDMachine *final_NFA = M.top(); M.pop();
-            std::cout << "Number of states in NFA " << nd_state_id << std::endl;
-            this->ndm = final_NFA;
-
         }
 
-        /// @brief Construct DFA using NFA using subset construction method
-        void construct_DFA(){
-            //  state_subset |  a0 | a1 | a2 ..
-            // {q0} -> {q1, q2} | {q1, q3} ...
-            int sz = alphabet.size();
-            std::map<std::set<NDNode*>, std::vector<std::set<NDNode*>>> dfa_table;
-            std::queue<std::set<NDNode*>> Q;
-            std::vector<NDNode*> start_closure = this->ndm->start->epsilon_closure(nullchar);
-            std::set<NDNode*> start_state(start_closure.begin(), start_closure.end());
-            std::set<std::set<NDNode*>> final_states;
-
-            {
-                bool isFinal = false;
-                for(auto& state: start_state){
-                    if(this->ndm->final_states.find(state) != this->ndm->final_states.end()){
-                        isFinal = true;
+        /// @brief Advances L lanes by step bytes each, the lookups of one byte position are issued together
+        template<int L>
+        void advance(uint32_t *state, const char *const *ptr, size_t step) const{
+            const uint32_t *t = trans;
+            size_t k = 0;
+#ifdef __AVX2__
+            // 8 lanes at a time with a gather, table offsets must fit in 32-bit signed indices
+            if(L%8 == 0 && table_size < ((size_t)1 << 31)){
+                const __m256i width = _mm256_set1_epi32(num_classes);
+                for(int g = 0; g<L; g += 8){
+                    __m256i st = _mm256_loadu_si256((const __m256i*)(state + g));
+                    for(k = 0; k<step; k++){
+                        __m256i cls = _mm256_setr_epi32(
+                            byte_class[(unsigned char)ptr[g][k]], byte_class[(unsigned char)ptr[g + 1][k]],
+                            byte_class[(unsigned char)ptr[g + 2][k]], byte_class[(unsigned char)ptr[g + 3][k]],
+                            byte_class[(unsigned char)ptr[g + 4][k]], byte_class[(unsigned char)ptr[g + 5][k]],
+                            byte_class[(unsigned char)ptr[g + 6][k]], byte_class[(unsigned char)ptr[g + 7][k]]);
+                        __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(st, width), cls);
+                        st = _mm256_i32gather_epi32((const int*)t, index, 4);
                     }
+                    _mm256_storeu_si256((__m256i*)(state + g), st);
                 }
-
-                if(isFinal){
-                    final_states.insert(start_state);
+                return;
+            }
+#endif
+            for(k = 0; k<step; k++){
+                for(int l = 0; l<L; l++){
+                    state[l] = t[state[l]*num_classes + byte_class[(unsigned char)ptr[l][k]]];
                 }
             }
+        }
 
-            dfa_table[start_state] = std::vector<std::set<NDNode*>>(sz);
-            Q.push(start_state);
-            while(!Q.empty()){
-                std::set<NDNode*> nd_state = Q.front(); Q.pop();
-                // Find null-closure of current subset
-                // Build subset for alphabet[i] transition from nd_state
-                // set value of nd_state --alphabet[i]--> target
-                // Check if target is a final state
-                // Add newly discovered subset in dfa_table
-
-                for(int i = 0; i<sz; i++){
-                    std::set<NDNode*> total_next;
-                    for(auto& state: nd_state){
-                        if(state->next.count(alphabet[i]) > 0){
-                            std::vector<NDNode*> trans = state->next[alphabet[i]];
-                            for(auto& s: trans){
-                                total_next.insert(s);
-                            }
-                        }
-                    }
-
-                    std::set<NDNode*> total_closure;
-                    for(auto& state: total_next){
-                        std::vector<NDNode*> closure = state->epsilon_closure(nullchar);
-                        for(auto& e: closure){
-                            total_closure.insert(e);
-                        }
-                    }
+        /// @brief Runs the bytes [s, s+len) from every state at once
+        /// Runs that reach the same state are merged into one lane, after the first byte and then every 64 bytes,
+        /// so the work quickly drops to the few states the input can actually be in.
+        /// @param result result[q] is the state reached when starting from q
+        void run_all(const char *s, size_t len, std::vector<uint32_t> &result) const{
+            result.resize(num_states);
+            if(len == 0){
+                for(int q = 0; q<num_states; q++){
+                    result[q] = q;
+                }
+                return;
+            }
 
-                    dfa_table[nd_state][i] = total_closure;
+            // After the first byte start state q is followed by lane first[q], equal targets share a lane
+            std::vector<uint32_t> seen(num_states, NO_STATE);
+            std::vector<uint32_t> lanes;
+            std::vector<uint32_t> first(num_states);
+            int cls = byte_class[(unsigned char)s[0]];
+            for(int q = 0; q<num_states; q++){
+                uint32_t target = trans[q*num_classes + cls];
+                if(seen[target] == NO_STATE){
+                    seen[target] = lanes.size();
+                    lanes.push_back(target);
+                }
+                first[q] = seen[target];
+            }
+            for(auto& target: lanes){
+                seen[target] = NO_STATE;
+            }
 
-                    bool isFinal = false;
-                    for(auto& state: total_closure){
-                        if(this->ndm->final_states.find(state) != this->ndm->final_states.end()){
-                            isFinal = true;
-                        }
+            // lane_of[f] is the lane now holding the run that was in lane f after the first byte
+            std::vector<uint32_t> lane_of(lanes.size());
+            for(int f = 0; f<(int)lanes.size(); f++){
+                lane_of[f] = f;
+            }
+            std::vector<uint32_t> remap;
+            const uint32_t *t = trans;
+            size_t i = 1;
+            while(i < len && lanes.size() > 1){
+                size_t end = std::min(len, i + 64);
+                int m = lanes.size();
+                for(size_t k = i; k<end; k++){
+                    const uint32_t *column = t + byte_class[(unsigned char)s[k]];
+                    for(int l = 0; l<m; l++){
+                        lanes[l] = column[lanes[l]*num_classes];
                     }
+                }
+                i = end;
 
-                    if(isFinal){
-                        final_states.insert(total_closure);
+                remap.resize(m);
+                int w = 0;
+                for(int l = 0; l<m; l++){
+                    uint32_t q = lanes[l];
+                    if(seen[q] == NO_STATE){
+                        seen[q] = w;
+                        lanes[w++] = q;
                     }
-
-                    if(dfa_table.count(total_closure) == 0){
-                        dfa_table[total_closure] = std::vector<std::set<NDNode*>>(sz);
-                        Q.push(total_closure);
+                    remap[l] = seen[q];
+                }
+                for(int l = 0; l<w; l++){
+                    seen[lanes[l]] = NO_STATE;
+                }
+                if(w < m){
+                    lanes.resize(w);
+                    for(auto& l: lane_of){
+                        l = remap[l];
                     }
-
-
                 }
-
+            }
+            if(i < len){
+                lanes[0] = run(lanes[0], s + i, len - i);
             }
 
-            std::cout << "Number of states in DFA " << dfa_table.size() << std::endl;
-
-            // Map (subset of NDNodes) to DNode
-            std::map<std::set<NDNode*>, DNode*> dfa_states;
-            for(auto& row: dfa_table){
-                dfa_states[row.first] = new DNode(d_state_id++);
+            for(int q = 0; q<num_states; q++){
+                result[q] = lanes[lane_of[first[q]]];
             }
+        }
 
-            // set the transition for each alphabet
-            for(auto& row: dfa_table){
-                DNode* state = dfa_states[row.first];
-                for(int i = 0; i<sz; i++){
-                    state->next[alphabet[i]] = dfa_states[row.second[i]];
+        /// @brief Advances from state over len bytes
+        /// Every EXIT_CHECK_INTERVAL bytes the exits of the current state are looked at: an absorbing state is the
+        /// result whatever follows, so the rest of the input is not read, and a state left by only a few bytes
+        /// jumps to the next of them with a memchr or SIMD scan.
+        /// @return the state reached after the last byte
+        uint32_t run(uint32_t state, const char *s, size_t len) const{
+            const uint32_t *t = trans;
+            if(exits.empty()){
+                for(size_t i = 0; i<len; i++){
+                    state = t[state*num_classes + byte_class[(unsigned char)s[i]]];
                 }
+                return state;
             }
 
-            // Construct DFA Machine 
-            DMachine *machine = new DMachine();
-            machine->alphabet = alphabet;
-            machine->start = dfa_states[start_state];
-            machine->end = nullptr;
-            //fill final states
-            for(auto& state: final_states){
-                machine->final_states.insert(dfa_states[state]);
+            for(size_t i = 0; i<len; ){
+                const StateExits &e = exits[state];
+                if(e.count == 0){
+                    return state;
+                }
+                if(e.count > 0){
+                    i = find_exit(e, s, i, len);
+                    if(i == len) break;
+                    state = t[state*num_classes + byte_class[(unsigned char)s[i++]]];
+                    continue;
+                }
+                size_t end = std::min(len, i + EXIT_CHECK_INTERVAL);
+                for(; i<end; i++){
+                    state = t[state*num_classes + byte_class[(unsigned char)s[i]]];
+                }
             }
 
-            this->dm = machine;
-
+            return state;
         }
 
-    public:
-        FA(){
+        std::vector<int> trace_states(const std::string &s) const{
+            std::vector<int> result;
+            result.reserve(s.size() + 1);
+            trace(s.data(), s.size(), [&](uint32_t state){
+                result.push_back(state);
+            });
+            // Input string has non-alphabet
+            if(result.size() != s.size() + 1){
+                return {};
+            }
 
+            return result;
         }
 
-        FA(const std::string &s, const std::string &alphabet, char nullchar){
-            this->regex = s;
-            this->alphabet = alphabet;
-            this->nullchar = nullchar;
-            this->nd_state_id = 0;
-            this->d_state_id = 0;
+        /// @brief Calls visit(state) for the start state and then for the state after each byte, in one pass
+        /// Stops at the first byte outside the alphabet, so visit is called len+1 times only when there is none.
+        /// @return whether s is accepted
+        template<typename Visit>
+        bool trace(const char *s, size_t len, Visit visit) const{
+            const uint32_t *t = trans;
+            uint32_t state = start;
 
-            construct_NFA();
-            construct_DFA();
+            visit(state);
+            for(size_t i = 0; i<len; i++){
+                int cls = byte_class[(unsigned char)s[i]];
+                if(cls == 0){
+                    return false;
+                }
+                state = t[state*num_classes + cls];
+                visit(state);
+            }
 
+            return is_final(state);
         }
 
-        void print_transition_table(){
-            std::cout << "Transition table of DFA" << std::endl;
-            this->dm->print_machine_table();
-        }
+        /// @brief Emits C++ functions bool name(const char*, size_t) and bool name(const std::string&) matching
+        /// like this DFA
+        /// Every state becomes a label and every transition a goto out of a switch on the next byte, so the
+        /// generated matcher reads no table. States looping to themselves on every byte (the dead state, or a final
+        /// state accepting any suffix) return as soon as they are entered.
+        void generate_cpp(std::ostream &out, const std::string &name) const{
+            // settled[q] is the result returned on entering q, -1 when q reads on
+            std::vector<int> settled(num_states, -1);
+            for(int q = 0; q<num_states; q++){
+                if(absorbing(q)){
+                    settled[q] = is_final(q);
+                }
+            }
+            auto jump = [&](uint32_t target){
+                if(settled[target] < 0){
+                    return "goto s" + std::to_string(target) + ";";
+                }
+                return std::string(settled[target] ? "return true;" : "return false;");
+            };
 
-        bool check(const std::string &s){
-            return this->dm->accepted(s);
-        }
+            out << "inline bool " << name << "(const char *s, std::size_t len){" << std::endl;
+            if(settled[start] >= 0){
+                out << "    (void)s;" << std::endl;
+                out << "    (void)len;" << std::endl;
+                out << "    " << jump(start) << std::endl;
+            }
+            else{
+                out << "    const unsigned char *p = (const unsigned char*)s;" << std::endl;
+                out << "    const unsigned char *end = p + len;" << std::endl;
+                out << "    goto s" << start << ";" << std::endl;
+            }
+            for(int q = 0; q<num_states; q++){
+                if(settled[start] >= 0) break;
+                if(settled[q] >= 0) continue;
+                out << "s" << q << ":" << std::endl;
+                out << "    if(p == end) return " << (is_final(q) ? "true" : "false") << ";" << std::endl;
+                out << "    switch(*p++){" << std::endl;
 
-        std::vector<int> trace_states(const std::string &s){
-            return this->dm->trace_states(s);
+                // Bytes going to the most frequent target fall to the default label
+                uint32_t target_of[256];
+                std::map<uint32_t, int> bytes_to;
+                for(int b = 0; b<256; b++){
+                    target_of[b] = trans[q*num_classes + byte_class[b]];
+                    bytes_to[target_of[b]]++;
+                }
+                uint32_t fallback = target_of[0];
+                for(auto& row: bytes_to){
+                    if(row.second > bytes_to[fallback]){
+                        fallback = row.first;
+                    }
+                }
+                std::vector<bool> written(256, false);
+                for(int b = 0; b<256; b++){
+                    if(written[b] || target_of[b] == fallback) continue;
+                    out << "       ";
+                    for(int other = b; other<256; other++){
+                        if(target_of[other] == target_of[b]){
+                            out << " case " << other << ":";
+                            written[other] = true;
+                        }
+                    }
+                    out << std::endl;
+                    out << "            " << jump(target_of[b]) << std::endl;
+                }
+                out << "        default:" << std::endl;
+                out << "            " << jump(fallback) << std::endl;
+                out << "    }" << std::endl;
+            }
+            out << "}" << std::endl;
+            out << std::endl;
+            out << "inline bool " << name << "(const std::string &s){" << std::endl;
+            out << "    return " << name << "(s.data(), s.size());" << std::endl;
+            out << "}" << std::endl;
         }
-
 };
 
-class FACompiler{
-    private:
+class NDMachine: public Machine{
+
+    public:
         std::string alphabet;
         char nullchar;
+        std::set<NDNode*> final_states;
+        NDNode* start;
+        NDNode* end;
 
-        bool check_bracket_balance(const std::string &s){
-            int sz = s.size();
-            std::string brackets = "()[]{}";
-            std::stack<char> open;
-            for(int i = 0; i<sz; i++){
-                int isBracket = -1;
-                for(int j = 0; j<6; j++){
-                    if(s[i] == brackets[j]){
-                        isBracket = j;
-                        break;
+        // Dense form built by index_states(), NFA states are addressed by their id
+        std::vector<NDNode*> states;
+        uint8_t byte_class[256];
+        std::string symbols;
+        // Epsilon closure of state p, sorted ids closure_ids[closure_begin[p] .. closure_begin[p+1])
+        std::vector<int> closure_begin;
+        std::vector<int> closure_ids;
+        std::vector<int> edge_begin;
+        std::vector<std::pair<int, int>> edges;
+        StateSet finals;
+        // Multi-pattern NFAs: pattern_ends[i] are the final nodes of pattern i, pattern_finals[i] their dense set
+        std::vector<std::vector<NDNode*>> pattern_ends;
+        std::vector<StateSet> pattern_finals;
+
+        // Bit-parallel form built by index_bit_parallel(), bp_words is 0 when the NFA does not fit or it was not built
+        static const int BP_MAX_WORDS = 4;
+        int bp_words = 0;
+        std::vector<uint64_t> bp_follow;
+        std::vector<uint64_t> bp_source;
+        std::vector<uint64_t> bp_target;
+
+        /// @brief Number the states densely and precompute epsilon closures as sorted id lists
+        /// Symbol transitions of state p are edges[edge_begin[p] .. edge_begin[p+1]) as (class, target id) pairs.
+        /// Class 0 collects bytes outside the alphabet, class i > 0 is a set of alphabet bytes labelling exactly the
+        /// same transitions, so they behave the same in every state and share a column; symbols[i] is its first byte.
+        /// @param num_states Number of NDNodes, ids must be in [0, num_states)
+        void index_states(int num_states){
+            states.assign(num_states, nullptr);
+            std::stack<NDNode*> S;
+            S.push(start);
+            states[start->id] = start;
+            auto visit = [&](NDNode *next){
+                if(states[next->id] == nullptr){
+                    states[next->id] = next;
+                    S.push(next);
+                }
+            };
+            while(!S.empty()){
+                NDNode* node = S.top(); S.pop();
+                for(auto& row: node->next){
+                    for(auto& next: row.second){
+                        visit(next);
                     }
                 }
+                for(auto& next: node->epsilon){
+                    visit(next);
+                }
+            }
+
+            index_classes();
 
-                if(isBracket>=0){
-                    if(isBracket%2 == 0){
-                        open.push(isBracket);
+            edge_begin.assign(num_states + 1, 0);
+            edges.clear();
+            finals = StateSet(num_states);
+            for(int p = 0; p<num_states; p++){
+                edge_begin[p] = edges.size();
+                if(states[p] == nullptr) continue;
+                for(auto& row: states[p]->next){
+                    int cls = byte_class[(unsigned char)row.first];
+                    if(cls == 0) continue;
+                    for(auto& next: row.second){
+                        edges.push_back({cls, next->id});
                     }
-                    else{
-                        if(!open.empty() && open.top()+1 == isBracket){
-                            open.pop();
-                        }
-                        else{
-                            return false;
+                }
+                // Bytes of one class repeat the same edges
+                std::sort(edges.begin() + edge_begin[p], edges.end());
+                edges.erase(std::unique(edges.begin() + edge_begin[p], edges.end()), edges.end());
+                if(final_states.find(states[p]) != final_states.end()){
+                    finals.insert(p);
+                }
+            }
+            edge_begin[num_states] = edges.size();
+            pattern_finals.assign(pattern_ends.size(), StateSet(num_states));
+            for(int i = 0; i<(int)pattern_ends.size(); i++){
+                for(auto& node: pattern_ends[i]){
+                    pattern_finals[i].insert(node->id);
+                }
+            }
+
+            // Epsilon closure of every state, computed once with a DFS per state. A state without epsilon edges
+            // is its own closure, so the lists together stay close to the number of states.
+            closure_begin.assign(num_states + 1, 0);
+            closure_ids.clear();
+            std::vector<int> stack;
+            std::vector<int> visited_by(num_states, -1);
+            for(int p = 0; p<num_states; p++){
+                closure_begin[p] = closure_ids.size();
+                if(states[p] == nullptr) continue;
+                visited_by[p] = p;
+                closure_ids.push_back(p);
+                if(states[p]->epsilon.empty()) continue;
+                stack.push_back(p);
+                while(!stack.empty()){
+                    NDNode* node = states[stack.back()]; stack.pop_back();
+                    for(auto& next: node->epsilon){
+                        if(visited_by[next->id] != p){
+                            visited_by[next->id] = p;
+                            closure_ids.push_back(next->id);
+                            stack.push_back(next->id);
                         }
                     }
                 }
+                std::sort(closure_ids.begin() + closure_begin[p], closure_ids.end());
             }
+            closure_begin[num_states] = closure_ids.size();
+        }
 
-            if(open.size() > 0){
-                return true;
+        /// @brief Adds the epsilon closure of state p to set
+        void add_closure(StateSet &set, int p) const{
+            for(int i = closure_begin[p]; i<closure_begin[p + 1]; i++){
+                set.insert(closure_ids[i]);
             }
+        }
 
-            return true;
-
+        /// @brief Epsilon closure of the start state, the set every match begins from
+        StateSet start_closure() const{
+            StateSet set(states.size());
+            add_closure(set, start->id);
+            return set;
         }
 
-        bool contains_alphabet(const std::string &s){
-            std::string specials = "(){}[].+*";
-            int sz = s.size();
-            for(int i = 0; i<sz; i++){
-                bool isSpecial = false;
-                for(int j = 0; j<9; j++){
-                    if(s[i] == specials[j]){
-                        isSpecial = true;
-                        break;
+        /// @brief Partition the alphabet into byte classes, two bytes share a class when they label the same
+        /// (source, target) transitions of the NFA
+        void index_classes(){
+            std::vector<std::vector<std::pair<int, int>>> signature(256);
+            for(auto& node: states){
+                if(node == nullptr) continue;
+                for(auto& row: node->next){
+                    for(auto& next: row.second){
+                        signature[(unsigned char)row.first].push_back({node->id, next->id});
                     }
                 }
+            }
 
-                if(!isSpecial){
-                    bool found = std::binary_search(this->alphabet.begin(), this->alphabet.end(), s[i]);
-                    if(!found) return false;
+            std::fill(byte_class, byte_class + 256, 0);
+            symbols.assign(1, '\0');
+            std::map<std::vector<std::pair<int, int>>, int> class_of;
+            for(auto& c: alphabet){
+                unsigned char b = c;
+                if(byte_class[b] != 0) continue;
+                std::sort(signature[b].begin(), signature[b].end());
+                auto found = class_of.find(signature[b]);
+                if(found == class_of.end()){
+                    found = class_of.insert({signature[b], (int)symbols.size()}).first;
+                    symbols.push_back(c);
                 }
+                byte_class[b] = found->second;
             }
+        }
 
+        /// @brief Build the Glushkov-style bit-parallel tables for NFAs of at most BP_MAX_WORDS * 64 states
+        /// Only run() uses them, so FA builds them for FAMode::NFA alone, after index_states().
+        /// A step is D' = follow(D & source[c]) & target[c], where follow(p) is the closure of every symbol target of p
+        /// and follow of a whole set is looked up one byte of D at a time. This is exact when for every edge p -c-> q,
+        /// closure(q) == follow(p) & target[c], which always holds for Thompson NFAs (one symbol edge per state).
+        void index_bit_parallel(){
+            int n = states.size();
+            int k = symbols.size();
+            bp_words = 0;
+            int words = (n + 63)/64;
+            if(n == 0 || words > BP_MAX_WORDS) return;
+
+            std::vector<uint64_t> follow(n*words, 0);
+            std::vector<uint64_t> source(k*words, 0);
+            std::vector<uint64_t> target(k*words, 0);
+            for(int p = 0; p<n; p++){
+                for(int e = edge_begin[p]; e<edge_begin[p + 1]; e++){
+                    int c = edges[e].first;
+                    source[c*words + (p >> 6)] |= (uint64_t)1 << (p & 63);
+                    for(int i = closure_begin[edges[e].second]; i<closure_begin[edges[e].second + 1]; i++){
+                        int q = closure_ids[i];
+                        follow[p*words + (q >> 6)] |= (uint64_t)1 << (q & 63);
+                        target[c*words + (q >> 6)] |= (uint64_t)1 << (q & 63);
+                    }
+                }
+            }
+
+            // Check exactness, closure(q) must equal follow(p) & target[c] for every edge p -c-> q
+            std::vector<uint64_t> reach(words);
+            for(int p = 0; p<n; p++){
+                for(int e = edge_begin[p]; e<edge_begin[p + 1]; e++){
+                    int c = edges[e].first;
+                    std::fill(reach.begin(), reach.end(), 0);
+                    for(int f = edge_begin[p]; f<edge_begin[p + 1]; f++){
+                        if(edges[f].first != c) continue;
+                        for(int i = closure_begin[edges[f].second]; i<closure_begin[edges[f].second + 1]; i++){
+                            reach[closure_ids[i] >> 6] |= (uint64_t)1 << (closure_ids[i] & 63);
+                        }
+                    }
+                    for(int w = 0; w<words; w++){
+                        if(reach[w] != (follow[p*words + w] & target[c*words + w])) return;
+                    }
+                }
+            }
+
+            // bp_follow[(chunk*256 + v)*words ..] is the union of follow(p) over the bits v of the chunk-th byte of D
+            int chunks = words*8;
+            bp_follow.assign(chunks*256*words, 0);
+            for(int j = 0; j<chunks; j++){
+                uint64_t *row = &bp_follow[j*256*words];
+                for(int v = 1; v<256; v++){
+                    int p = j*8 + __builtin_ctz(v);
+                    int prev = v & (v - 1);
+                    for(int w = 0; w<words; w++){
+                        row[v*words + w] = row[prev*words + w] | (p < n ? follow[p*words + w] : 0);
+                    }
+                }
+            }
+            bp_source = std::move(source);
+            bp_target = std::move(target);
+            bp_words = words;
+        }
+
+        /// @brief Closed set of states reached from the closed set current on class cls
+        void step(const StateSet &current, int cls, StateSet &result) const{
+            result.clear();
+            current.for_each([&](int p){
+                for(int e = edge_begin[p]; e<edge_begin[p + 1]; e++){
+                    // closure of a state already in the closed result is already included
+                    if(edges[e].first == cls && !result.contains(edges[e].second)){
+                        add_closure(result, edges[e].second);
+                    }
+                }
+            });
+        }
+
+        /// @brief Prints the NFA states, null transitions are listed under the null character
+        void print_machine_table(){
+            std::cout << "States starting with * are final states" << std::endl;
+            std::cout << "Starting state is " << start->id << std::endl;
+            std::cout << std::endl;
+            int n = states.size();
+            for(int p = 0; p<n; p++){
+                if(states[p] == nullptr) continue;
+                if(finals.contains(p)){
+                    std::cout << "*";
+                }
+                std::cout << p << "\t=>\t";
+                if(!states[p]->epsilon.empty()){
+                    std::cout << nullchar << ":{";
+                    for(int i = 0; i<(int)states[p]->epsilon.size(); i++){
+                        std::cout << (i ? "," : "") << states[p]->epsilon[i]->id;
+                    }
+                    std::cout << "}\t";
+                }
+                for(auto& row: states[p]->next){
+                    if(row.second.empty()) continue;
+                    std::cout << row.first << ":{";
+                    for(int i = 0; i<(int)row.second.size(); i++){
+                        std::cout << (i ? "," : "") << row.second[i]->id;
+                    }
+                    std::cout << "}\t";
+                }
+                std::cout << std::endl;
+            }
+            std::cout << std::endl;
+        }
+
+        /// @brief Simulates the NFA over bit-vector state sets, no DFA state is ever built
+        /// Each byte costs one pass over the current set, so matching is O(|s| * number of states).
+        bool accepted(const std::string &s) const{
+            return accepted(s.data(), s.size());
+        }
+
+        bool accepted(const char *s, size_t len) const{
+            StateSet current = start_closure();
+            run(current, s, len);
+            return current.intersects(finals);
+        }
+
+        /// @brief Bytes held by the dense form built by index_states()
+        size_t memory_bytes() const{
+            size_t words = (states.size() + 63)/64;
+            size_t bytes = states.size()*sizeof(NDNode*) + edge_begin.size()*sizeof(int);
+            bytes += edges.size()*sizeof(std::pair<int, int>);
+            bytes += (closure_begin.size() + closure_ids.size())*sizeof(int);
+            bytes += (pattern_finals.size() + 1)*(sizeof(StateSet) + words*sizeof(uint64_t));
+            bytes += (bp_follow.size() + bp_source.size() + bp_target.size())*sizeof(uint64_t);
+            return bytes;
+        }
+
+        /// @brief Ids of the patterns whose final state is in the set, in increasing order
+        std::vector<int> patterns_in(const StateSet &set) const{
+            std::vector<int> result;
+            for(int i = 0; i<(int)pattern_finals.size(); i++){
+                if(set.intersects(pattern_finals[i])){
+                    result.push_back(i);
+                }
+            }
+            return result;
+        }
+
+        /// @brief Advances the closed set current over len bytes
+        void run(StateSet &current, const char *s, size_t len) const{
+            if(bp_words == 1){
+                return run_bit_parallel<1>(current, s, len);
+            }
+            if(bp_words == 2){
+                return run_bit_parallel<2>(current, s, len);
+            }
+            if(bp_words > 0){
+                return run_bit_parallel<BP_MAX_WORDS>(current, s, len);
+            }
+
+            StateSet next(states.size());
+            for(size_t i = 0; i<len; i++){
+                int cls = byte_class[(unsigned char)s[i]];
+                step(current, cls, next);
+                std::swap(current, next);
+                if(current.empty()){
+                    return;
+                }
+            }
+        }
+
+        /// @brief Fast path of run() for NFAs that fit in W machine words, see index_bit_parallel()
+        template<int W>
+        void run_bit_parallel(StateSet &set, const char *s, size_t len) const{
+            int words = bp_words;
+            uint64_t current[W] = {}, masked[W];
+            for(int w = 0; w<words; w++){
+                current[w] = set.bits[w];
+            }
+            for(size_t i = 0; i<len; i++){
+                int cls = byte_class[(unsigned char)s[i]];
+                const uint64_t *source = &bp_source[cls*words];
+                const uint64_t *target = &bp_target[cls*words];
+                uint64_t any = 0;
+                for(int w = 0; w<words; w++){
+                    masked[w] = current[w] & source[w];
+                    current[w] = 0;
+                }
+                for(int j = 0; j<words*8; j++){
+                    int v = (masked[j >> 3] >> ((j & 7)*8)) & 255;
+                    if(v == 0) continue;
+                    const uint64_t *follow = &bp_follow[(j*256 + v)*words];
+                    for(int w = 0; w<words; w++){
+                        current[w] |= follow[w];
+                    }
+                }
+                for(int w = 0; w<words; w++){
+                    current[w] &= target[w];
+                    any |= current[w];
+                }
+                if(any == 0){
+                    break;
+                }
+            }
+
+            for(int w = 0; w<words; w++){
+                set.bits[w] = current[w];
+            }
+        }
+};
+
+const int NDMachine::BP_MAX_WORDS;
+const uint32_t DMachine::NO_STATE;
+const int DMachine::LANES;
+const size_t DMachine::INTERLEAVE_MIN_LENGTH;
+const size_t DMachine::EXIT_CHECK_INTERVAL;
+const int DMachine::MAX_EXIT_BYTES;
+
+/// @brief Layout of a DFA file written by FA::save
+/// The header is followed by the alphabet, the transition table and the final-state bitmap, each starting on an
+/// 8-byte boundary so that a mapped file can be matched in place. Numbers are stored in the byte order of the
+/// writing machine, byte_order holds ORDER_MARK as written.
+struct DFAFileHeader{
+    static const char MAGIC[8];
+    static const uint32_t VERSION = 1;
+    static const uint32_t ORDER_MARK = 0x01020304;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t num_states;
+    uint32_t num_classes;
+    uint32_t start;
+    uint32_t dead;
+    uint32_t alphabet_size;
+    uint32_t nullchar;
+    // FNV-1a of the whole file, computed with this field set to 0
+    uint64_t checksum;
+    uint8_t byte_class[256];
+
+    size_t alphabet_offset() const{
+        return sizeof(DFAFileHeader);
+    }
+
+    size_t table_offset() const{
+        return alphabet_offset() + ((alphabet_size + 7) & ~(size_t)7);
+    }
+
+    size_t final_offset() const{
+        return table_offset() + (((size_t)num_states*num_classes*sizeof(uint32_t) + 7) & ~(size_t)7);
+    }
+
+    size_t file_size() const{
+        return final_offset() + ((size_t)num_states + 63)/64*sizeof(uint64_t);
+    }
+
+    static uint64_t fnv1a(uint64_t hash, const char *data, size_t len){
+        for(size_t i = 0; i<len; i++){
+            hash = (hash ^ (unsigned char)data[i])*0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    /// @brief Checksum of a whole file starting with this header
+    uint64_t compute_checksum(const char *file, size_t len) const{
+        DFAFileHeader copy = *this;
+        copy.checksum = 0;
+        uint64_t hash = fnv1a(0xcbf29ce484222325ULL, (const char*)&copy, sizeof(copy));
+        return fnv1a(hash, file + sizeof(copy), len - sizeof(copy));
+    }
+};
+
+const char DFAFileHeader::MAGIC[8] = {'R', 'E', 'G', 'E', 'X', 'D', 'F', 'A'};
+const uint32_t DFAFileHeader::VERSION;
+const uint32_t DFAFileHeader::ORDER_MARK;
+
+/// @brief shared_ptr that is only read and written atomically
+/// The free std::atomic_load and std::atomic_store overloads for shared_ptr are deprecated in C++20 in favour of
+/// std::atomic<std::shared_ptr>, which C++14 lacks. The tree targets C++14 so they are kept, and only called here so
+/// that this class is all there is to change when it moves to std::atomic<std::shared_ptr>.
+template<typename T>
+class AtomicSharedPtr{
+    public:
+        std::shared_ptr<T> load() const{
+            return std::atomic_load(&ptr);
+        }
+
+        void store(std::shared_ptr<T> value){
+            std::atomic_store(&ptr, std::move(value));
+        }
+
+    private:
+        std::shared_ptr<T> ptr;
+};
+
+/// @brief DFA built on the fly from an indexed NDMachine while matching.
+/// Only the subsets reached by the inputs are constructed. They live in a cache whose estimated size is bounded by
+/// cache_budget bytes, when a new state would exceed it the whole cache is flushed and matching resumes from the
+/// current subset. State ids are therefore only stable between flushes.
+/// The cache is logically part of the NFA it is built from, matching methods are const. Following a cached
+/// transition takes no lock, a state's row of targets is published one entry at a time once the target exists.
+/// The mutex only serializes building new states and is never held while calling back into the caller.
+class LazyDMachine: public Machine{
+    public:
+        // States allocated at once by a cache
+        static const size_t STATE_BLOCK = 64;
+
+        /// @brief Cached DFA state, directly followed in memory by its row of targets
+        struct State{
+            uint32_t id;
+            bool final;
+            // Key of the state in Cache::index
+            const StateSet *subset;
+
+            /// @brief Target on class cls, null until it is computed
+            std::atomic<const State*>& next(int cls) const{
+                return reinterpret_cast<std::atomic<const State*>*>(const_cast<State*>(this) + 1)[cls];
+            }
+        };
+
+        /// @brief States built between two flushes
+        /// A flush publishes a new Cache. Matchers still walking the old one keep it alive through their shared_ptr
+        /// and move to the new one at their next missing transition.
+        struct Cache{
+            std::vector<const State*> states;
+            std::unordered_map<StateSet, const State*, StateSetHash> index;
+            // Memory of the states and their rows, STATE_BLOCK states per block
+            std::vector<std::unique_ptr<char[]>> blocks;
+            size_t block_left = 0;
+            // State 0, written before the cache is published so readers never touch states while it grows
+            const State *start = nullptr;
+            size_t bytes = 0;
+        };
+
+        const NDMachine *nfa;
+        size_t cache_budget;
+        int num_classes;
+        mutable std::mutex lock;
+        mutable int flushes;
+        mutable AtomicSharedPtr<Cache> cache;
+
+        LazyDMachine(const NDMachine *nfa, size_t cache_budget){
+            this->nfa = nfa;
+            this->cache_budget = cache_budget;
+            this->num_classes = nfa->symbols.size();
+            this->flushes = 0;
+            flush();
+            this->flushes = 0;
+        }
+
+        /// @brief Estimated memory held by one cached state: subset bits, row of targets and hash node
+        size_t state_bytes() const{
+            return nfa->finals.bits.size()*sizeof(uint64_t) + num_classes*sizeof(const State*) + 64;
+        }
+
+        /// @brief Drop every cached state by publishing a new cache holding only the start state, lock held
+        /// @param expected states the new cache is sized for
+        /// @return the new cache
+        std::shared_ptr<Cache> flush(size_t expected = 0) const{
+            std::shared_ptr<Cache> fresh = std::make_shared<Cache>();
+            fresh->index.reserve(expected);
+            fresh->start = intern(*fresh, nfa->start_closure());
+            cache.store(fresh);
+            flushes++;
+            return fresh;
+        }
+
+        /// @brief State of subset in c, created when it is new, lock held
+        const State* intern(Cache &c, const StateSet &subset) const{
+            auto it = c.index.find(subset);
+            if(it != c.index.end()){
+                return it->second;
+            }
+            size_t slot = sizeof(State) + num_classes*sizeof(std::atomic<const State*>);
+            if(c.block_left == 0){
+                c.blocks.emplace_back(new char[STATE_BLOCK*slot]);
+                c.block_left = STATE_BLOCK;
+            }
+            State *state = new(c.blocks.back().get() + (STATE_BLOCK - c.block_left--)*slot) State();
+            for(int i = 0; i<num_classes; i++){
+                new(&state->next(i)) std::atomic<const State*>(nullptr);
+            }
+            state->id = c.states.size();
+            state->final = subset.intersects(nfa->finals);
+            state->subset = &c.index.insert({subset, state}).first->first;
+            c.states.push_back(state);
+            c.bytes += state_bytes();
+            return state;
+        }
+
+        /// @brief Build the transition of state on class cls, flushing the cache first if it is full
+        /// @param c cache state belongs to, replaced by the current cache when it was flushed meanwhile
+        /// @return target state, in c as it is after the call
+        const State* compute(std::shared_ptr<Cache> &c, const State *state, int cls) const{
+            std::lock_guard<std::mutex> guard(lock);
+            // Keeps state alive while c moves to another cache
+            std::shared_ptr<Cache> owner = c;
+            c = cache.load();
+            if(c != owner){
+                state = intern(*c, *state->subset);
+            }
+            const State *target = state->next(cls).load(std::memory_order_acquire);
+            if(target){
+                return target;
+            }
+
+            StateSet next(nfa->states.size());
+            nfa->step(*state->subset, cls, next);
+            if(c->index.find(next) == c->index.end() && c->bytes + state_bytes() > cache_budget){
+                std::shared_ptr<Cache> full = c;
+                c = flush(full->states.size());
+                state = intern(*c, *state->subset);
+            }
+            target = intern(*c, next);
+            state->next(cls).store(target, std::memory_order_release);
+            return target;
+        }
+
+        /// @brief Prints the states built so far, ? marks transitions not computed yet
+        void print_machine_table(){
+            std::lock_guard<std::mutex> guard(lock);
+            std::shared_ptr<Cache> c = cache.load();
+            std::cout << "States starting with * are final states, DFA is built lazily" << std::endl;
+            std::cout << "Cached states " << c->states.size() << ", cache flushes " << flushes << std::endl;
+            std::cout << "Starting state is 0" << std::endl;
+            std::cout << std::endl;
+            int sz = nfa->alphabet.size();
+            for(const State *state: c->states){
+                if(state->final){
+                    std::cout << "*";
+                }
+                std::cout << state->id << "\t=>\t";
+                for(int i = 0; i<sz; i++){
+                    char ch = nfa->alphabet[i];
+                    const State *next = state->next(nfa->byte_class[(unsigned char)ch]).load(std::memory_order_acquire);
+                    if(!next){
+                        std::cout << ch << ":?\t";
+                    }
+                    else{
+                        std::cout << ch << ":" << next->id << "\t";
+                    }
+                }
+                std::cout << std::endl;
+            }
+            std::cout << std::endl;
+        }
+
+        bool accepted(const std::string &s) const{
+            return accepted(s.data(), s.size());
+        }
+
+        bool accepted(const char *s, size_t len) const{
+            std::shared_ptr<Cache> c = cache.load();
+            const State *state = c->start;
+            for(size_t i = 0; i<len; i++){
+                int cls = nfa->byte_class[(unsigned char)s[i]];
+                const State *next = state->next(cls).load(std::memory_order_acquire);
+                if(!next){
+                    next = compute(c, state, cls);
+                }
+                state = next;
+            }
+
+            return state->final;
+        }
+
+        /// @brief Advances the closed set current over len bytes through the cache
+        void run(StateSet &current, const char *s, size_t len) const{
+            std::shared_ptr<Cache> c;
+            const State *state;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                c = cache.load();
+                state = intern(*c, current);
+            }
+            for(size_t i = 0; i<len; i++){
+                int cls = nfa->byte_class[(unsigned char)s[i]];
+                const State *next = state->next(cls).load(std::memory_order_acquire);
+                if(!next){
+                    next = compute(c, state, cls);
+                }
+                state = next;
+            }
+            current = *state->subset;
+        }
+
+        std::vector<int> trace_states(const std::string &s) const{
+            std::vector<int> result;
+            result.reserve(s.size() + 1);
+            trace(s.data(), s.size(), [&](uint32_t state){
+                result.push_back(state);
+            });
+            // Input string has non-alphabet
+            if(result.size() != s.size() + 1){
+                return {};
+            }
+
+            return result;
+        }
+
+        /// @brief Same as DMachine::trace, state ids are those of the cache and change when it is flushed
+        template<typename Visit>
+        bool trace(const char *s, size_t len, Visit visit) const{
+            std::shared_ptr<Cache> c = cache.load();
+            const State *state = c->start;
+
+            visit(state->id);
+            for(size_t i = 0; i<len; i++){
+                int cls = nfa->byte_class[(unsigned char)s[i]];
+                if(cls == 0){
+                    return false;
+                }
+                const State *next = state->next(cls).load(std::memory_order_acquire);
+                if(!next){
+                    next = compute(c, state, cls);
+                }
+                state = next;
+                visit(state->id);
+            }
+
+            return state->final;
+        }
+};
+
+const size_t LazyDMachine::STATE_BLOCK;
+
+/// @brief Fixed set of worker threads with one task deque per worker.
+/// A worker takes tasks from the front of its own deque and, when that is empty, steals from the back of the
+/// others. The thread calling parallel_for() helps with the work until all of its tasks completed.
+class ThreadPool{
+    private:
+        struct Task{
+            const std::function<void(int)> *f;
+            int index;
+            std::atomic<int> *remaining;
+        };
+        struct TaskQueue{
+            std::mutex lock;
+            std::deque<Task> tasks;
+        };
+
+        // queues[workers.size()] is shared by the threads calling parallel_for()
+        std::vector<std::unique_ptr<TaskQueue>> queues;
+        std::vector<std::thread> workers;
+        std::mutex idle_lock;
+        std::condition_variable idle;
+        std::condition_variable done;
+        std::atomic<int> pending;
+        bool stopping;
+
+        bool pop(int self, Task &task){
+            int sz = queues.size();
+            for(int i = 0; i<sz; i++){
+                TaskQueue &queue = *queues[(self + i)%sz];
+                std::lock_guard<std::mutex> guard(queue.lock);
+                if(queue.tasks.empty()) continue;
+                if(i == 0){
+                    task = queue.tasks.front(); queue.tasks.pop_front();
+                }
+                else{
+                    task = queue.tasks.back(); queue.tasks.pop_back();
+                }
+                pending--;
+                return true;
+            }
+            return false;
+        }
+
+        void run(const Task &task){
+            (*task.f)(task.index);
+            if(--*task.remaining == 0){
+                std::lock_guard<std::mutex> guard(idle_lock);
+                done.notify_all();
+            }
+        }
+
+        void worker(int self){
+            while(true){
+                Task task;
+                if(pop(self, task)){
+                    run(task);
+                    continue;
+                }
+                std::unique_lock<std::mutex> guard(idle_lock);
+                idle.wait(guard, [&]{ return stopping || pending > 0; });
+                if(stopping && pending == 0) return;
+            }
+        }
+
+    public:
+        /// @param threads Number of worker threads, the calling thread of parallel_for() comes on top of them
+        ThreadPool(int threads){
+            this->pending = 0;
+            this->stopping = false;
+            for(int i = 0; i<=threads; i++){
+                queues.push_back(std::make_unique<TaskQueue>());
+            }
+            for(int i = 0; i<threads; i++){
+                workers.emplace_back(&ThreadPool::worker, this, i);
+            }
+        }
+
+        ~ThreadPool(){
+            {
+                std::lock_guard<std::mutex> guard(idle_lock);
+                stopping = true;
+            }
+            idle.notify_all();
+            for(auto& t: workers){
+                t.join();
+            }
+        }
+
+        int size() const{
+            return workers.size() + 1;
+        }
+
+        /// @brief Calls f(i) for every i in [0, n) across the pool and returns once all calls completed
+        void parallel_for(int n, const std::function<void(int)> &f){
+            if(n <= 0) return;
+            if(workers.empty() || n == 1){
+                for(int i = 0; i<n; i++){
+                    f(i);
+                }
+                return;
+            }
+
+            std::atomic<int> remaining(n);
+            int sz = queues.size();
+            pending += n;
+            for(int i = 0; i<n; i++){
+                TaskQueue &queue = *queues[i%sz];
+                std::lock_guard<std::mutex> guard(queue.lock);
+                queue.tasks.push_back({&f, i, &remaining});
+            }
+            {
+                std::lock_guard<std::mutex> guard(idle_lock);
+            }
+            idle.notify_all();
+
+            int self = workers.size();
+            while(remaining > 0){
+                Task task;
+                if(pop(self, task)){
+                    run(task);
+                    continue;
+                }
+                std::unique_lock<std::mutex> guard(idle_lock);
+                done.wait(guard, [&]{ return remaining == 0 || pending > 0; });
+            }
+        }
+
+        /// @brief Process-wide pool with one thread per hardware core
+        static ThreadPool& shared(){
+            static ThreadPool pool(std::max(1, (int)std::thread::hardware_concurrency()) - 1);
+            return pool;
+        }
+};
+
+/// @brief Matching engine used by a compiled FA
+enum class FAMode{
+    DFA,        // eager subset construction, flat transition table
+    LAZY_DFA,   // DFA states built on demand from the NFA with a bounded cache
+    NFA         // bit-parallel NFA simulation, no DFA construction at all
+};
+
+/// @brief How a compiled FA builds its NFA from the postfix regex
+enum class FAConstruction{
+    THOMPSON,   // two states and up to four epsilon edges per operator
+    GLUSHKOV    // position automaton, one state per symbol occurrence plus the start state, no epsilon edges
+};
+
+/// @brief Set operation of FA::product on the languages of two compiled FAs
+enum class FASetOp{
+    INTERSECTION,   // strings both FAs accept
+    UNION,          // strings either FA accepts
+    DIFFERENCE      // strings the first FA accepts and the second does not
+};
+
+/// @brief Compilation settings passed from FACompiler to FA
+struct FAOptions{
+    bool minimize = true;
+    FAMode mode = FAMode::DFA;
+    FAConstruction construction = FAConstruction::THOMPSON;
+    size_t lazy_cache_bytes = 8 << 20;
+    bool search = false;
+    // Runs the subset construction on this pool, on the compiling thread when null. It does not change the result.
+    ThreadPool *compile_pool = nullptr;
+};
+
+/// @brief Measurements of one compilation, see FA::stats()
+/// The index phase numbers the NFA states and computes their epsilon closures. The dfa phase is the subset
+/// construction, it does not run in the lazy and NFA modes. Search DFAs are counted in the search phase only.
+struct FAStats{
+    // Seconds spent in each phase
+    double postfix_seconds = 0;
+    double nfa_seconds = 0;
+    double index_seconds = 0;
+    double dfa_seconds = 0;
+    double minimize_seconds = 0;
+    double search_seconds = 0;
+    // Estimated bytes allocated by each phase
+    size_t nfa_bytes = 0;
+    size_t index_bytes = 0;
+    size_t dfa_bytes = 0;
+    size_t minimize_bytes = 0;
+    size_t search_bytes = 0;
+    int nfa_states = 0;
+    // Columns of the transition tables: byte equivalence classes, with class 0 for bytes outside the alphabet
+    int byte_classes = 0;
+    // DFA states before and after minimization
+    int dfa_states = 0;
+    int min_dfa_states = 0;
+    // Epsilon closures computed by the index phase, and closures merged into subsets by the subset construction
+    long long closures = 0;
+    long long closure_merges = 0;
+    // Distinct NFA subsets interned by the subset construction, and the bytes of that table
+    long long subsets = 0;
+    size_t subset_table_bytes = 0;
+};
+
+/// @brief Counters a FA adds to while matching, see FA::set_match_stats
+/// Updated with relaxed atomics, so one FAMatchStats can be shared by all the threads matching with an FA.
+struct FAMatchStats{
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> accepted{0};
+    std::atomic<uint64_t> bytes_scanned{0};
+
+    void add(uint64_t calls, uint64_t accepted, uint64_t bytes){
+        this->calls.fetch_add(calls, std::memory_order_relaxed);
+        this->accepted.fetch_add(accepted, std::memory_order_relaxed);
+        this->bytes_scanned.fetch_add(bytes, std::memory_order_relaxed);
+    }
+};
+
+/// @brief Seconds elapsed on the steady clock since begin
+inline double seconds_since(std::chrono::steady_clock::time_point begin){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+/// @brief Byte ranges [first, second] of a character class
+typedef std::vector<std::pair<unsigned char, unsigned char>> ByteRanges;
+
+/// @brief One token of a postfix regex
+/// Operators are '+' (union), '.' (concatenation), '*', '?' and "{m,n}", where n is left out when unbounded.
+/// An operand is a plain character, "\xHH" for any byte, a class "[...]" listing bytes b and byte ranges l-h written
+/// either way, or a literal string of bytes between double quotes. The null character alone is the empty string.
+struct PostfixToken{
+    char op;                // the operator, '{' for a repetition, 0 for an operand
+    int min, max;           // bounds of a repetition, max is -1 when unbounded
+    bool empty;             // the operand matches the empty string
+    ByteRanges ranges;      // or the operand matches one byte of these ranges
+    std::string literal;    // or, when not empty, the operand matches exactly this string
+};
+
+inline int hex_digit(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/// @brief Reads the postfix token starting at regex[i] and moves i past it
+inline PostfixToken read_postfix_token(const std::string &regex, size_t &i, char nullchar){
+    auto read_byte = [&]() -> unsigned char {
+        if(regex[i] == '\\'){
+            unsigned char b = hex_digit(regex[i + 2])*16 + hex_digit(regex[i + 3]);
+            i += 4;
+            return b;
+        }
+        return regex[i++];
+    };
+    auto read_number = [&](){
+        int n = 0;
+        while(regex[i] >= '0' && regex[i] <= '9'){
+            n = n*10 + (regex[i++] - '0');
+        }
+        return n;
+    };
+    PostfixToken token = {0, 0, 0, false, {}, ""};
+    char c = regex[i];
+    if(c == '+' || c == '.' || c == '*' || c == '?'){
+        token.op = c;
+        i++;
+    }
+    else if(c == '{'){
+        token.op = c;
+        i++;
+        token.min = read_number();
+        i++;
+        token.max = (regex[i] == '}') ? -1 : read_number();
+        i++;
+    }
+    else if(c == nullchar){
+        token.empty = true;
+        i++;
+    }
+    else if(c == '['){
+        i++;
+        while(regex[i] != ']'){
+            unsigned char lo = read_byte(), hi = lo;
+            if(regex[i] == '-'){
+                i++;
+                hi = read_byte();
+            }
+            token.ranges.push_back({lo, hi});
+        }
+        i++;
+    }
+    else if(c == '"'){
+        i++;
+        while(regex[i] != '"'){
+            token.literal.push_back(read_byte());
+        }
+        i++;
+    }
+    else{
+        unsigned char b = read_byte();
+        token.ranges.push_back({b, b});
+    }
+    return token;
+}
+
+/// @brief Appends byte b as written in a postfix operand
+/// Bytes are written plain when they are printable and have no other meaning in a postfix regex, "\xHH" otherwise.
+inline void write_postfix_byte(std::string &out, unsigned char b, char nullchar){
+    if(isgraph(b) && b != (unsigned char)nullchar && !strchr("+.*?{[]-\"\\", b)){
+        out.push_back(b);
+    }
+    else{
+        const char *digits = "0123456789abcdef";
+        out += "\\x";
+        out.push_back(digits[b >> 4]);
+        out.push_back(digits[b & 15]);
+    }
+}
+
+/// @brief Appends the postfix operand matching one byte of ranges, which must not be empty
+inline void write_postfix_class(std::string &out, const ByteRanges &ranges, char nullchar){
+    auto write_byte = [&](unsigned char b){
+        write_postfix_byte(out, b, nullchar);
+    };
+    if(ranges.size() == 1 && ranges[0].first == ranges[0].second){
+        write_byte(ranges[0].first);
+        return;
+    }
+    out.push_back('[');
+    for(auto& range: ranges){
+        write_byte(range.first);
+        if(range.second != range.first){
+            out.push_back('-');
+            write_byte(range.second);
+        }
+    }
+    out.push_back(']');
+}
+
+inline void write_postfix_range(std::string &out, unsigned char lo, unsigned char hi, char nullchar){
+    write_postfix_class(out, {{lo, hi}}, nullchar);
+}
+
+/// @brief Appends the postfix operand matching exactly the string literal, of two bytes or more
+inline void write_postfix_literal(std::string &out, const std::string &literal, char nullchar){
+    out.push_back('"');
+    for(auto& c: literal){
+        write_postfix_byte(out, c, nullchar);
+    }
+    out.push_back('"');
+}
+
+class FA{
+
+    friend class FAStream;
+    friend class FACompiler;
+
+    private:
+        // Every NFA node of this FA lives in nd_nodes and is released with it
+        std::deque<NDNode> nd_nodes;
+        std::unique_ptr<NDMachine> ndm;
+        std::unique_ptr<DMachine> dm;
+        std::unique_ptr<LazyDMachine> ldm;
+        FAOptions options;
+        std::string alphabet;
+        std::string regex;
+        // Postfix regexes of a multi-pattern FA, empty for a single regex
+        std::vector<std::string> patterns;
+        char nullchar;
+        int nd_state_id;
+        FAStats statistics;
+        FAMatchStats *match_stats = nullptr;
+
+        // Machines used by search(), see construct_search()
+        std::deque<NDNode> rev_nodes;
+        std::unique_ptr<NDMachine> rev_ndm;
+        std::unique_ptr<DMachine> search_dm;
+        std::unique_ptr<DMachine> reverse_dm;
+        // Literal facts used by search() to skip input, see extract_prefilter()
+        std::string required_literal;
+        // Offset in required_literal of the byte memchr looks for, the one least common in text
+        size_t rare_offset;
+        bool first_byte[256];
+        int num_first_bytes;
+        // The first bytes as the exits of a state for DMachine::find_exit, count is -1 when there are too many
+        DMachine::StateExits first_exits;
+
+        /// @brief Allocates a new NFA node in the arena of this FA
+        NDNode* new_node(){
+            nd_nodes.emplace_back(nd_state_id++);
+            return &nd_nodes.back();
+        }
+
+        /// @brief Performs Union operation according to thompson's rule
+        /// @param a NFA fragment A
+        /// @param b NFA fragment B
+        /// @return returns new fragment with +2 states and +4 null transistions => (A+B)
+        NDFragment thompson_union(NDFragment a, NDFragment b){
+            NDNode *q0, *q1;
+            q0 = new_node();
+            q1 = new_node();
+
+            q0->epsilon.push_back(a.start);
+            q0->epsilon.push_back(b.start);
+            a.end->epsilon.push_back(q1);
+            b.end->epsilon.push_back(q1);
+
+            return {q0, q1};
+        }
+
+        /// @brief Performs Kleene-closure according to thompson's rule
+        /// @param a Kleene-closure of a
+        /// @return returns new fragment with +2 states and +4 null transitions => (a*)
+        NDFragment thompson_kleene_closure(NDFragment a){
+            NDNode *q0, *q1;
+            q0 = new_node();
+            q1 = new_node();
+
+            q0->epsilon.push_back(a.start);
+            a.end->epsilon.push_back(q1);
+            a.end->epsilon.push_back(a.start);
+            q0->epsilon.push_back(q1);
+
+            return {q0, q1};
+        }
+
+        /// @brief Performs concatenation operation according to thompson's rule
+        /// @param a NFA fragment A
+        /// @param b NFA fragment B
+        /// @return returns new fragment with +1 null transition => (AB)
+        NDFragment thompson_concatenate(NDFragment a, NDFragment b){
+            a.end->epsilon.push_back(b.start);
+
+            return {a.start, b.end};
+        }
+
+        /// @brief Converts an operand token to NFA fragment
+        /// @param token Byte ranges of the transition, the empty string or a literal string
+        /// @return returns fragment with 2 states and 1 transition on every byte of the class => (q0 -c-> q1),
+        /// or a chain of one transition per byte of the literal without null transitions
+        NDFragment token_to_machine(const PostfixToken &token){
+            NDNode *q0, *q1;
+            q0 = new_node();
+            if(!token.literal.empty()){
+                q1 = q0;
+                for(auto& c: token.literal){
+                    NDNode *q = new_node();
+                    q1->next[c].push_back(q);
+                    q1 = q;
+                }
+                return {q0, q1};
+            }
+            q1 = new_node();
+
+            if(token.empty){
+                q0->epsilon.push_back(q1);
+            }
+            for(auto& range: token.ranges){
+                for(int c = range.first; c<=range.second; c++){
+                    q0->next[(char)c].push_back(q1);
+                }
+            }
+
+            return {q0, q1};
+        }
+
+        /// @brief Builds a{min,max} from copies of a, max is -1 when unbounded
+        /// The min mandatory copies are concatenated, then either the last one loops back on itself or the
+        /// max - min optional copies follow, each able to skip to one shared end node. The NFA thus grows
+        /// linearly with the bounds, and the epsilon closure of every state stays as small as in a unless a
+        /// matches the empty string. simplify_repeat rewrites (a?){n} into a{0,n} for that reason.
+        /// @param copy Builds a new fragment for the same sub-expression as a
+        NDFragment thompson_repeat(NDFragment a, int min, int max, const std::function<NDFragment()> &copy){
+            if(max == -1 && min == 0){
+                return thompson_kleene_closure(a);
+            }
+            int copies = (max == -1) ? min : max;
+            std::vector<NDFragment> parts = {a};
+            for(int k = 1; k<copies; k++){
+                parts.push_back(copy());
+            }
+
+            NDNode *start = (min == 0) ? new_node() : a.start;
+            NDNode *end = new_node();
+            NDNode *current = start;
+            for(int k = 0; k<copies; k++){
+                if(k >= min){
+                    current->epsilon.push_back(end);
+                }
+                if(k > 0 || min == 0){
+                    current->epsilon.push_back(parts[k].start);
+                }
+                current = parts[k].end;
+            }
+            current->epsilon.push_back(end);
+            if(max == -1){
+                parts.back().end->epsilon.push_back(parts.back().start);
+            }
+
+            return {start, end};
+        }
+
+        /// @brief Apply thompson's rule step-wise based on post-fix notation of Regex
+        /// @brief Builds the NFA fragment of a postfix regex with thompson's rules
+        NDFragment postfix_to_fragment(const std::string &regex){
+            size_t sz = regex.size();
+            // Fragments with the index in regex where their sub-expression starts, repetitions rebuild it for copies
+            std::stack<std::pair<NDFragment, size_t>> M;
+            std::string ops = "+*.?{";
+            for(size_t i = 0; i<sz; ){
+                size_t begin = i;
+                PostfixToken token = read_postfix_token(regex, i, nullchar);
+                int isOps = -1;
+                for(int j = 0; j<5; j++){
+                    if(token.op == ops[j]){
+                        isOps = j;
+                        break;
+                    }
+                }
+
+                if(isOps == 0){
+                    NDFragment rm = M.top().first; M.pop();
+                    M.top().first = thompson_union(M.top().first, rm);
+                }
+                else if(isOps == 1){
+                    M.top().first = thompson_kleene_closure(M.top().first);
+                }
+                else if(isOps == 2){
+                    NDFragment rm = M.top().first; M.pop();
+                    M.top().first = thompson_concatenate(M.top().first, rm);
+                }
+                else if(isOps >= 3){
+                    int min = (isOps == 3) ? 0 : token.min;
+                    int max = (isOps == 3) ? 1 : token.max;
+                    std::string operand = regex.substr(M.top().second, begin - M.top().second);
+                    M.top().first = thompson_repeat(M.top().first, min, max, [&](){
+                        return postfix_to_fragment(operand);
+                    });
+                }
+                else{
+                    M.push({token_to_machine(token), begin});
+                }
+            }
+
+            return M.top().first;
+        }
+
+        /// @brief First and last positions of a sub-expression in the Glushkov construction
+        struct PositionInfo{
+            bool nullable;
+            std::vector<NDNode*> first;
+            std::vector<NDNode*> last;
+        };
+
+        /// @brief Symbols and follow sets of the positions of a Glushkov automaton under construction
+        struct PositionGraph{
+            // symbol[p] is the byte class entering position p, follow sets become edges once the regex is read
+            std::map<NDNode*, ByteRanges> symbol;
+            std::map<NDNode*, std::set<NDNode*>> follow;
+        };
+
+        /// @brief Positions of a postfix regex, added to graph
+        PositionInfo glushkov_info(const std::string &regex, PositionGraph &graph){
+            // Position info with the index in regex where its sub-expression starts, repetitions re-read it for copies
+            std::stack<std::pair<PositionInfo, size_t>> M;
+            auto concatenate = [&](PositionInfo &l, PositionInfo r){
+                for(auto& p: l.last){
+                    graph.follow[p].insert(r.first.begin(), r.first.end());
+                }
+                if(l.nullable){
+                    l.first.insert(l.first.end(), r.first.begin(), r.first.end());
+                }
+                if(r.nullable){
+                    r.last.insert(r.last.end(), l.last.begin(), l.last.end());
+                }
+                l.last = std::move(r.last);
+                l.nullable = l.nullable && r.nullable;
+            };
+            auto loop = [&](PositionInfo &m){
+                for(auto& p: m.last){
+                    graph.follow[p].insert(m.first.begin(), m.first.end());
+                }
+            };
+            for(size_t i = 0; i<regex.size(); ){
+                size_t begin = i;
+                PostfixToken token = read_postfix_token(regex, i, nullchar);
+                char c = token.op;
+                if(c == '+'){
+                    PositionInfo r = M.top().first; M.pop();
+                    PositionInfo &l = M.top().first;
+                    l.nullable = l.nullable || r.nullable;
+                    l.first.insert(l.first.end(), r.first.begin(), r.first.end());
+                    l.last.insert(l.last.end(), r.last.begin(), r.last.end());
+                }
+                else if(c == '*'){
+                    loop(M.top().first);
+                    M.top().first.nullable = true;
+                }
+                else if(c == '.'){
+                    PositionInfo r = std::move(M.top().first); M.pop();
+                    concatenate(M.top().first, std::move(r));
+                }
+                else if(c == '?' || c == '{'){
+                    // a{min,max} is min copies of a followed by a loop on the last copy when unbounded, or by the
+                    // nested optional copies (a(a(a)?)?)?, in which only the previous copy links to the next one
+                    int min = (c == '?') ? 0 : token.min;
+                    int max = (c == '?') ? 1 : token.max;
+                    std::string operand = regex.substr(M.top().second, begin - M.top().second);
+                    int copies = (max == -1) ? std::max(min, 1) : max;
+                    std::vector<PositionInfo> parts = {M.top().first};
+                    for(int k = 1; k<copies; k++){
+                        parts.push_back(glushkov_info(operand, graph));
+                    }
+                    if(max == -1){
+                        loop(parts.back());
+                    }
+                    // Moved rather than copied, the last positions of the chain grow with every copy
+                    PositionInfo optional = {true, {}, {}};
+                    for(int k = copies - 1; k>=min; k--){
+                        concatenate(parts[k], std::move(optional));
+                        optional = std::move(parts[k]);
+                        optional.nullable = true;
+                    }
+                    PositionInfo result = {true, {}, {}};
+                    for(int k = 0; k<min && k<copies; k++){
+                        concatenate(result, std::move(parts[k]));
+                    }
+                    concatenate(result, std::move(optional));
+                    M.top().first = result;
+                }
+                else if(token.empty){
+                    // The null character stands for the empty string
+                    M.push({{true, {}, {}}, begin});
+                }
+                else if(!token.literal.empty()){
+                    // One position per byte, each followed only by the next one
+                    NDNode *first = nullptr, *last = nullptr;
+                    for(auto& c: token.literal){
+                        NDNode *position = new_node();
+                        graph.symbol[position] = {{(unsigned char)c, (unsigned char)c}};
+                        if(last == nullptr){
+                            first = position;
+                        }
+                        else{
+                            graph.follow[last].insert(position);
+                        }
+                        last = position;
+                    }
+                    M.push({{false, {first}, {last}}, begin});
+                }
+                else{
+                    NDNode *position = new_node();
+                    graph.symbol[position] = token.ranges;
+                    M.push({{false, {position}, {position}}, begin});
+                }
+            }
+
+            return M.top().first;
+        }
+
+        /// @brief Builds the position (Glushkov) automaton of a postfix regex from start
+        /// Every symbol occurrence becomes one node, entered on that symbol. Edges go from start to the first
+        /// positions and from every position to the positions that may follow it, there is no epsilon edge.
+        /// @return the final nodes, the last positions and start itself when the regex matches the empty string
+        std::vector<NDNode*> glushkov_positions(const std::string &regex, NDNode *start){
+            PositionGraph graph;
+            PositionInfo whole = glushkov_info(regex, graph);
+            auto enter = [&](NDNode *from, NDNode *p){
+                for(auto& range: graph.symbol[p]){
+                    for(int c = range.first; c<=range.second; c++){
+                        from->next[(char)c].push_back(p);
+                    }
+                }
+            };
+            for(auto& p: whole.first){
+                enter(start, p);
+            }
+            for(auto& row: graph.follow){
+                for(auto& p: row.second){
+                    enter(row.first, p);
+                }
+            }
+            if(whole.nullable){
+                whole.last.push_back(start);
+            }
+            return whole.last;
+        }
+
+        void construct_NFA(){
+            this->ndm = std::make_unique<NDMachine>();
+            if(options.construction == FAConstruction::GLUSHKOV){
+                // One start state shared by all the patterns, each keeps its own final positions
+                NDNode *start = new_node();
+                if(patterns.empty()){
+                    for(auto& node: glushkov_positions(regex, start)){
+                        this->ndm->final_states.insert(node);
+                    }
+                }
+                for(auto& pattern: patterns){
+                    std::vector<NDNode*> ends = glushkov_positions(pattern, start);
+                    this->ndm->final_states.insert(ends.begin(), ends.end());
+                    this->ndm->pattern_ends.push_back(ends);
+                }
+                this->ndm->start = start;
+                this->ndm->end = nullptr;
+            }
+            else{
+                NDFragment final_NFA;
+                if(patterns.empty()){
+                    final_NFA = postfix_to_fragment(regex);
+                }
+                else{
+                    // Union of all the patterns at the top, each keeps its own end node to tell which one matched
+                    final_NFA = {new_node(), new_node()};
+                    for(auto& pattern: patterns){
+                        NDFragment m = postfix_to_fragment(pattern);
+                        final_NFA.start->epsilon.push_back(m.start);
+                        m.end->epsilon.push_back(final_NFA.end);
+                        this->ndm->pattern_ends.push_back({m.end});
+                    }
+                }
+                this->ndm->start = final_NFA.start;
+                this->ndm->end = final_NFA.end;
+                this->ndm->final_states.insert(final_NFA.end);
+            }
+            this->ndm->alphabet = this->alphabet;
+            this->ndm->nullchar = this->nullchar;
+
+            statistics.nfa_states = nd_state_id;
+            statistics.nfa_bytes = nodes_bytes(nd_nodes);
+        }
+
+        /// @brief Estimated bytes held by NFA nodes and their transition maps
+        static size_t nodes_bytes(const std::deque<NDNode> &nodes){
+            size_t bytes = nodes.size()*sizeof(NDNode);
+            for(auto& node: nodes){
+                bytes += node.epsilon.capacity()*sizeof(NDNode*);
+                for(auto& row: node.next){
+                    // map node: the pair and about four pointers of tree bookkeeping
+                    bytes += sizeof(row) + 4*sizeof(void*) + row.second.capacity()*sizeof(NDNode*);
+                }
+            }
+            return bytes;
+        }
+
+        /// @brief Construct DFA using NFA using subset construction method, the NFA must be indexed
+        void construct_DFA(){
+            this->dm = subset_construction(this->ndm.get(), this->alphabet, false);
+        }
+
+        /// @brief Subset construction over an indexed NFA
+        /// NFA subsets are bitsets over dense state ids built from the memoized epsilon closures,
+        /// and each distinct subset is interned once in a hash table.
+        /// @param alphabet Alphabet of the NFA, kept by the DFA
+        /// @param unanchored Build the DFA of (any string).R instead: the start subset is added back after every
+        /// byte, and bytes outside the alphabet restart from the start state instead of going to the dead state
+        std::unique_ptr<DMachine> subset_construction(const NDMachine *nfa, const std::string &alphabet, bool unanchored){
+            //  state_subset |  c1 | c2 | c3 ..
+            // {q0} -> {q1, q2} | {q1, q3} ...
+            int sz = nfa->symbols.size();
+            int n = nfa->states.size();
+            const StateSet start_state = nfa->start_closure();
+
+            // DFA states are numbered in the order they are discovered, start state is 0
+            std::unordered_map<StateSet, uint32_t, StateSetHash> dfa_states;
+            std::vector<const StateSet*> subsets;
+            std::vector<uint32_t> table;
+            std::vector<bool> final_states;
+            // Pattern labels of a multi-pattern NFA, distinct sets of pattern ids are numbered in label_ids
+            bool labeled = !nfa->pattern_ends.empty();
+            std::vector<uint32_t> state_label;
+            std::vector<std::vector<int>> label_sets;
+            std::map<std::vector<int>, uint32_t> label_ids;
+            if(labeled){
+                label_sets.push_back({});
+                label_ids[{}] = 0;
+            }
+
+            auto intern = [&](StateSet subset){
+                auto it = dfa_states.find(subset);
+                if(it != dfa_states.end()){
+                    return it->second;
+                }
+                uint32_t id = subsets.size();
+                it = dfa_states.insert({std::move(subset), id}).first;
+                const StateSet &interned = it->first;
+                subsets.push_back(&interned);
+                final_states.push_back(interned.intersects(nfa->finals));
+                if(labeled){
+                    std::vector<int> ids = nfa->patterns_in(interned);
+                    auto label = label_ids.find(ids);
+                    if(label == label_ids.end()){
+                        label = label_ids.insert({ids, label_sets.size()}).first;
+                        label_sets.push_back(ids);
+                    }
+                    state_label.push_back(label->second);
+                }
+                return id;
+            };
+
+            intern(start_state);
+            // The DFA is explored one BFS level at a time. Successors of the states of a level are computed in
+            // parallel, in chunks, and looked up in dfa_states, which is only read during that phase. The subsets
+            // not found are then interned in (state, class) order on the calling thread, so the numbering is the
+            // one of a sequential BFS whatever the number of threads.
+            ThreadPool *pool = options.compile_pool;
+            // States of a level expanded by one task
+            const uint32_t SUBSET_CHUNK = 64;
+            long long merges = 0;
+            for(uint32_t level_begin = 0; level_begin<subsets.size(); ){
+                uint32_t level_end = subsets.size();
+                int chunks = (level_end - level_begin + SUBSET_CHUNK - 1)/SUBSET_CHUNK;
+                table.resize(level_end*sz);
+                // missing[cur - level_begin] lists the classes and subsets of cur not interned yet
+                std::vector<std::vector<std::pair<int, StateSet>>> missing(level_end - level_begin);
+                std::vector<long long> chunk_merges(chunks, 0);
+
+                std::function<void(int)> expand = [&](int chunk){
+                    // next[i] accumulates the closed subset reached on class i
+                    std::vector<StateSet> next(sz, StateSet(n));
+                    uint32_t end = std::min<uint32_t>(level_end, level_begin + (chunk + 1)*SUBSET_CHUNK);
+                    for(uint32_t cur = level_begin + chunk*SUBSET_CHUNK; cur<end; cur++){
+                        // Union the closures of every symbol transition out of the current subset, one pass for all classes
+                        subsets[cur]->for_each([&](int p){
+                            for(int e = nfa->edge_begin[p]; e<nfa->edge_begin[p + 1]; e++){
+                                // a target already in the subset brought its closed set along with it
+                                StateSet &target = next[nfa->edges[e].first];
+                                if(!target.contains(nfa->edges[e].second)){
+                                    nfa->add_closure(target, nfa->edges[e].second);
+                                }
+                            }
+                            chunk_merges[chunk] += nfa->edge_begin[p + 1] - nfa->edge_begin[p];
+                        });
+
+                        for(int i = 1; i<sz; i++){
+                            if(unanchored){
+                                next[i].merge(start_state);
+                            }
+                            auto it = dfa_states.find(next[i]);
+                            if(it != dfa_states.end()){
+                                table[cur*sz + i] = it->second;
+                                next[i].clear();
+                            }
+                            else{
+                                missing[cur - level_begin].push_back({i, std::move(next[i])});
+                                next[i] = StateSet(n);
+                            }
+                        }
+                    }
+                };
+                if(pool != nullptr){
+                    pool->parallel_for(chunks, expand);
+                }
+                else{
+                    for(int chunk = 0; chunk<chunks; chunk++){
+                        expand(chunk);
+                    }
+                }
+
+                for(uint32_t cur = level_begin; cur<level_end; cur++){
+                    for(auto& successor: missing[cur - level_begin]){
+                        table[cur*sz + successor.first] = intern(std::move(successor.second));
+                    }
+                }
+                for(auto& m: chunk_merges){
+                    merges += m;
+                }
+                level_begin = level_end;
+            }
+
+            // Bytes outside the alphabet go to the dead state (empty subset), created if no symbol reaches it
+            uint32_t dead = DMachine::NO_STATE;
+            if(!unanchored){
+                dead = intern(StateSet(n));
+                if(table.size() < subsets.size()*sz){
+                    table.resize(subsets.size()*sz);
+                    for(int i = 1; i<sz; i++){
+                        table[dead*sz + i] = dead;
+                    }
+                }
+            }
+            for(uint32_t cur = 0; cur<subsets.size(); cur++){
+                table[cur*sz] = unanchored ? 0 : dead;
+            }
+
+            // Construct DFA Machine
+            std::unique_ptr<DMachine> machine = std::make_unique<DMachine>();
+            machine->alphabet = alphabet;
+            std::copy(nfa->byte_class, nfa->byte_class + 256, machine->byte_class);
+            machine->num_classes = sz;
+            machine->num_states = subsets.size();
+            machine->start = 0;
+            machine->dead = dead;
+            machine->table = std::move(table);
+            machine->final_states.assign((subsets.size() + 63)/64, 0);
+            //fill final states
+            for(uint32_t state = 0; state<subsets.size(); state++){
+                if(final_states[state]){
+                    machine->final_states[state >> 6] |= (uint64_t)1 << (state & 63);
+                }
+            }
+            machine->state_label = std::move(state_label);
+            machine->label_sets = std::move(label_sets);
+            machine->bind();
+
+            // Interned subsets: the bitset, its StateSet and about four words of hash node and bucket
+            statistics.closure_merges += merges;
+            statistics.subsets += subsets.size();
+            statistics.subset_table_bytes += subsets.size()*(sizeof(StateSet) + 4*sizeof(void*)
+                                                             + (n + 63)/64*sizeof(uint64_t));
+
+            return machine;
+
+        }
+
+        /// @brief Minimize the DFA
+        void minimize_DFA(){
+            minimize(this->dm.get());
+        }
+
+        /// @brief Minimize a DFA with Hopcroft's partition refinement
+        /// Starts from the partition by label ({final, non-final}, or the accepted pattern set of a multi-pattern DFA)
+        /// and splits blocks by predecessor sets until stable,
+        /// then rebuilds the DMachine with one state per block, numbered in BFS order from the start state.
+        void minimize(DMachine *machine){
+            int n = machine->num_states;
+            int k = machine->num_classes;
+            const std::vector<uint32_t> &table = machine->table;
+
+            // inverse transitions: sources of t on class c are inv_src[inv_off[c*(n+1)+t] .. inv_off[c*(n+1)+t+1])
+            std::vector<int> inv_off(k*(n + 1), 0);
+            std::vector<int> inv_src(n*k);
+            for(int q = 0; q<n; q++){
+                for(int c = 0; c<k; c++){
+                    inv_off[c*(n + 1) + table[q*k + c] + 1]++;
+                }
+            }
+            for(int c = 0; c<k; c++){
+                int base = c*(n + 1);
+                for(int t = 0; t<n; t++){
+                    inv_off[base + t + 1] += inv_off[base + t];
+                }
+                inv_off[base] += c*n;
+                for(int t = 1; t<=n; t++){
+                    inv_off[base + t] += c*n;
+                }
+            }
+            {
+                std::vector<int> fill(inv_off);
+                for(int q = 0; q<n; q++){
+                    for(int c = 0; c<k; c++){
+                        inv_src[fill[c*(n + 1) + table[q*k + c]]++] = q;
+                    }
+                }
+            }
+
+            // Partition: states of block b are elems[first[b] .. end[b]), the first marked[b] of them are marked
+            std::vector<int> elems(n), loc(n), block(n);
+            std::vector<int> first, end, marked;
+            {
+                // Initial blocks group the states by label, laid out with a counting sort
+                int labels = machine->num_labels();
+                std::vector<int> label_begin(labels + 1, 0);
+                for(int q = 0; q<n; q++){
+                    label_begin[machine->label(q) + 1]++;
+                }
+                for(int l = 0; l<labels; l++){
+                    label_begin[l + 1] += label_begin[l];
+                }
+                std::vector<int> label_block(labels, -1);
+                for(int l = 0; l<labels; l++){
+                    if(label_begin[l + 1] > label_begin[l]){
+                        label_block[l] = first.size();
+                        first.push_back(label_begin[l]);
+                        end.push_back(label_begin[l + 1]);
+                        marked.push_back(0);
+                    }
+                }
+                for(int q = 0; q<n; q++){
+                    int pos = label_begin[machine->label(q)]++;
+                    elems[pos] = q;
+                    loc[q] = pos;
+                    block[q] = label_block[machine->label(q)];
+                }
+            }
+
+            // Worklist of (block, class) splitters, every initial block but the largest is enough
+            std::vector<std::pair<int, int>> worklist;
+            std::vector<char> in_worklist(n*k, 0);
+            int largest = 0;
+            for(int b = 1; b<(int)first.size(); b++){
+                if(end[b] - first[b] > end[largest] - first[largest]){
+                    largest = b;
+                }
+            }
+            for(int b = 0; b<(int)first.size(); b++){
+                if(b == largest) continue;
+                for(int c = 0; c<k; c++){
+                    worklist.push_back({b, c});
+                    in_worklist[b*k + c] = 1;
+                }
+            }
+
+            statistics.minimize_bytes += (inv_off.size() + inv_src.size() + 3*n)*sizeof(int) + in_worklist.size();
+
+            std::vector<int> splitter;
+            std::vector<int> touched;
+            while(!worklist.empty()){
+                std::pair<int, int> top = worklist.back(); worklist.pop_back();
+                int b = top.first, c = top.second;
+                in_worklist[b*k + c] = 0;
+
+                // Collect predecessors on c of the splitter block before any split changes it
+                splitter.clear();
+                for(int i = first[b]; i<end[b]; i++){
+                    int t = elems[i];
+                    for(int j = inv_off[c*(n + 1) + t]; j<inv_off[c*(n + 1) + t + 1]; j++){
+                        splitter.push_back(inv_src[j]);
+                    }
+                }
+
+                touched.clear();
+                for(auto& q: splitter){
+                    int y = block[q];
+                    int pos = loc[q];
+                    int mark = first[y] + marked[y];
+                    if(pos < mark) continue;
+                    if(marked[y] == 0){
+                        touched.push_back(y);
+                    }
+                    int other = elems[mark];
+                    elems[mark] = q; loc[q] = mark;
+                    elems[pos] = other; loc[other] = pos;
+                    marked[y]++;
+                }
+
+                for(auto& y: touched){
+                    int mc = marked[y];
+                    marked[y] = 0;
+                    if(mc == end[y] - first[y]) continue;
+
+                    // Marked prefix becomes the new block z
+                    int z = first.size();
+                    first.push_back(first[y]);
+                    end.push_back(first[y] + mc);
+                    marked.push_back(0);
+                    first[y] += mc;
+                    for(int i = first[z]; i<end[z]; i++){
+                        block[elems[i]] = z;
+                    }
+
+                    int small = (end[z] - first[z] <= end[y] - first[y]) ? z : y;
+                    for(int a = 0; a<k; a++){
+                        if(in_worklist[y*k + a]){
+                            worklist.push_back({z, a});
+                            in_worklist[z*k + a] = 1;
+                        }
+                        else{
+                            worklist.push_back({small, a});
+                            in_worklist[small*k + a] = 1;
+                        }
+                    }
+                }
+            }
+
+            // Renumber blocks in BFS order from the start state and rebuild the table
+            int m = first.size();
+            std::vector<int> order(m, -1);
+            std::vector<int> reps;
+            order[block[machine->start]] = 0;
+            reps.push_back(machine->start);
+            for(int i = 0; i<(int)reps.size(); i++){
+                for(int c = 0; c<k; c++){
+                    int next = block[table[reps[i]*k + c]];
+                    if(order[next] < 0){
+                        order[next] = reps.size();
+                        reps.push_back(table[reps[i]*k + c]);
+                    }
+                }
+            }
+
+            std::vector<uint32_t> min_table(m*k);
+            std::vector<uint64_t> min_final((m + 63)/64, 0);
+            std::vector<uint32_t> min_label(machine->state_label.empty() ? 0 : m);
+            for(int i = 0; i<m; i++){
+                for(int c = 0; c<k; c++){
+                    min_table[i*k + c] = order[block[table[reps[i]*k + c]]];
+                }
+                if(machine->is_final(reps[i])){
+                    min_final[i >> 6] |= (uint64_t)1 << (i & 63);
+                }
+                if(!min_label.empty()){
+                    min_label[i] = machine->state_label[reps[i]];
+                }
+            }
+
+            machine->num_states = m;
+            machine->start = 0;
+            if(machine->dead != DMachine::NO_STATE){
+                machine->dead = order[block[machine->dead]];
+            }
+            machine->table = std::move(min_table);
+            machine->final_states = std::move(min_final);
+            machine->state_label = std::move(min_label);
+            machine->bind();
+        }
+
+        /// @brief Build the DFAs used by search()
+        /// search_dm recognizes (any string).R and finds where matches end, reverse_dm is the same for the reversed
+        /// NFA and finds where matches start, and dm (built here if the mode did not need it) gives the longest match.
+        void construct_search(){
+            if(!this->dm){
+                this->dm = subset_construction(this->ndm.get(), this->alphabet, false);
+                if(options.minimize){
+                    minimize(this->dm.get());
+                }
+            }
+            this->search_dm = subset_construction(this->ndm.get(), this->alphabet, true);
+
+            // Reverse NFA: every edge flipped on a mirror node with the same id, start and end swapped
+            std::vector<NDNode*> mirror(nd_state_id);
+            for(auto& node: nd_nodes){
+                rev_nodes.emplace_back(node.id);
+                mirror[node.id] = &rev_nodes.back();
+            }
+            for(auto& node: nd_nodes){
+                for(auto& row: node.next){
+                    for(auto& next: row.second){
+                        mirror[next->id]->next[row.first].push_back(mirror[node.id]);
+                    }
+                }
+                for(auto& next: node.epsilon){
+                    mirror[next->id]->epsilon.push_back(mirror[node.id]);
+                }
+            }
+            this->rev_ndm = std::make_unique<NDMachine>();
+            if(this->ndm->final_states.size() == 1){
+                this->rev_ndm->start = mirror[(*this->ndm->final_states.begin())->id];
+            }
+            else{
+                // Several final states (Glushkov) are reached from one new start node
+                rev_nodes.emplace_back(nd_state_id);
+                this->rev_ndm->start = &rev_nodes.back();
+                for(auto& node: this->ndm->final_states){
+                    this->rev_ndm->start->epsilon.push_back(mirror[node->id]);
+                }
+            }
+            this->rev_ndm->end = mirror[this->ndm->start->id];
+            this->rev_ndm->final_states.insert(this->rev_ndm->end);
+            this->rev_ndm->alphabet = this->alphabet;
+            this->rev_ndm->nullchar = this->nullchar;
+            this->rev_ndm->index_states(nd_state_id + 1);
+            this->reverse_dm = subset_construction(this->rev_ndm.get(), this->alphabet, true);
+
+            if(options.minimize){
+                minimize(this->search_dm.get());
+                minimize(this->reverse_dm.get());
+            }
+            extract_prefilter();
+        }
+
+        /// @brief Rough frequency rank of a byte in text, higher is more common
+        /// Space and the most frequent English letters rank highest, then the other letters, digits, punctuation and
+        /// UTF-8 continuation bytes, and control bytes lowest.
+        static int byte_rank(unsigned char c){
+            static const char common[] = "etaoinshrdlcumwfgypbvkjxqz";
+            if(c == ' ') return 255;
+            const char *letter = std::strchr(common, std::tolower(c));
+            if(c != 0 && letter != nullptr){
+                return (std::islower(c) ? 200 : 100) - (letter - common);
+            }
+            if(std::isdigit(c)) return 70;
+            if(c == '\n' || std::ispunct(c)) return 50;
+            if(c >= 0x80 && c < 0xc0) return 40;
+            return c >= 0x80 ? 20 : 0;
+        }
+
+        /// @brief Whether text contains required_literal
+        /// memchr finds each occurrence of the rarest byte of the literal and the whole literal is compared around it.
+        bool contains_required_literal(const char *text, size_t len) const{
+            size_t size = required_literal.size();
+            if(size > len){
+                return false;
+            }
+            char rare = required_literal[rare_offset];
+            // Occurrences of the rare byte from first to last leave room for the rest of the literal
+            const char *p = text + rare_offset;
+            const char *last = text + (len - size) + rare_offset;
+            while(p <= last){
+                p = (const char*)std::memchr(p, rare, last - p + 1);
+                if(p == nullptr){
+                    return false;
+                }
+                if(std::memcmp(p - rare_offset, required_literal.data(), size) == 0){
+                    return true;
+                }
+                p++;
+            }
+            return false;
+        }
+
+        /// @brief Literal facts every match of a sub-expression satisfies, used by extract_prefilter()
+        struct LiteralInfo{
+            bool nullable;
+            bool exact;             // the sub-expression matches exactly the string prefix
+            std::string prefix;     // every match starts with it
+            std::string suffix;     // every match ends with it
+            std::string required;   // every match contains it
+            std::vector<bool> first;
+        };
+
+        /// @brief Computes from the postfix regex the set of bytes a match can start with and the longest literal
+        /// found that every match must contain
+        void extract_prefilter(){
+            std::stack<LiteralInfo> S;
+            size_t sz = regex.size();
+            auto longest = [](const std::string &a, const std::string &b){
+                return a.size() >= b.size() ? a : b;
+            };
+            for(size_t i = 0; i<sz; ){
+                PostfixToken token = read_postfix_token(regex, i, nullchar);
+                char c = token.op;
+                LiteralInfo info;
+                if(c == '+' || c == '.'){
+                    LiteralInfo b = S.top(); S.pop();
+                    LiteralInfo a = S.top(); S.pop();
+                    info.first = a.first;
+                    if(c == '.'){
+                        info.nullable = a.nullable && b.nullable;
+                        info.exact = a.exact && b.exact;
+                        info.prefix = a.exact ? a.prefix + b.prefix : a.prefix;
+                        info.suffix = b.exact ? a.suffix + b.suffix : b.suffix;
+                        info.required = longest(longest(a.required, b.required), a.suffix + b.prefix);
+                        if(a.nullable){
+                            for(int j = 0; j<256; j++){
+                                if(b.first[j]) info.first[j] = true;
+                            }
+                        }
+                    }
+                    else{
+                        info.nullable = a.nullable || b.nullable;
+                        info.exact = a.exact && b.exact && a.prefix == b.prefix;
+                        int p = 0, q = 0;
+                        while(p < (int)std::min(a.prefix.size(), b.prefix.size()) && a.prefix[p] == b.prefix[p]) p++;
+                        while(q < (int)std::min(a.suffix.size(), b.suffix.size()) && a.suffix[a.suffix.size() - 1 - q] == b.suffix[b.suffix.size() - 1 - q]) q++;
+                        info.prefix = a.prefix.substr(0, p);
+                        info.suffix = a.suffix.substr(a.suffix.size() - q);
+                        info.required = (a.required == b.required) ? a.required : longest(info.prefix, info.suffix);
+                        for(int j = 0; j<256; j++){
+                            if(b.first[j]) info.first[j] = true;
+                        }
+                    }
+                }
+                else if(c == '*'){
+                    LiteralInfo a = S.top(); S.pop();
+                    info.nullable = true;
+                    info.exact = false;
+                    info.first = a.first;
+                }
+                else if(c == '?' || c == '{'){
+                    LiteralInfo a = S.top(); S.pop();
+                    int min = (c == '?') ? 0 : token.min;
+                    int max = (c == '?') ? 1 : token.max;
+                    info.first = a.first;
+                    if(min == 0){
+                        info.nullable = true;
+                        info.exact = (max == 0);
+                        if(max == 0){
+                            info.first.assign(256, false);
+                        }
+                    }
+                    else{
+                        // min copies of an exact a are the same string every time
+                        info.nullable = a.nullable;
+                        info.exact = a.exact && min == max;
+                        std::string repeated;
+                        for(int k = 0; a.exact && k<min; k++){
+                            repeated += a.prefix;
+                        }
+                        info.prefix = a.exact ? repeated : a.prefix;
+                        info.suffix = a.exact ? repeated : a.suffix;
+                        info.required = a.exact ? repeated : a.required;
+                    }
+                }
+                else if(!token.literal.empty()){
+                    info.nullable = false;
+                    info.exact = true;
+                    info.prefix = info.suffix = info.required = token.literal;
+                    info.first.assign(256, false);
+                    info.first[(unsigned char)token.literal[0]] = true;
+                }
+                else{
+                    // A class is no literal, only a single byte or the empty string is
+                    info.nullable = token.empty;
+                    info.exact = token.empty || (token.ranges.size() == 1 && token.ranges[0].first == token.ranges[0].second);
+                    if(!token.empty && info.exact){
+                        info.prefix = info.suffix = info.required = std::string(1, (char)token.ranges[0].first);
+                    }
+                    info.first.assign(256, false);
+                    for(auto& range: token.ranges){
+                        for(int j = range.first; j<=range.second; j++){
+                            info.first[j] = true;
+                        }
+                    }
+                }
+                S.push(info);
+            }
+
+            LiteralInfo info = S.top();
+            required_literal = info.required;
+            rare_offset = 0;
+            for(size_t j = 1; j<required_literal.size(); j++){
+                if(byte_rank(required_literal[j]) < byte_rank(required_literal[rare_offset])){
+                    rare_offset = j;
+                }
+            }
+            num_first_bytes = 0;
+            first_exits.count = 0;
+            for(int j = 0; j<256; j++){
+                first_byte[j] = info.first[j];
+                num_first_bytes += first_byte[j];
+                if(first_byte[j] && first_exits.count < DMachine::MAX_EXIT_BYTES){
+                    first_exits.bytes[first_exits.count++] = j;
+                }
+            }
+            if(num_first_bytes > DMachine::MAX_EXIT_BYTES){
+                first_exits.count = -1;
+            }
+        }
+
+        /// @brief Position of the first byte at or after i that can start a match, len if there is none
+        /// Up to three first bytes are found with memchr or the SSE2 scan of DMachine::find_exit.
+        size_t skip_to_first_byte(const char *text, size_t i, size_t len) const{
+            if(first_exits.count > 0){
+                return DMachine::find_exit(first_exits, text, i, len);
+            }
+            while(i < len && !first_byte[(unsigned char)text[i]]){
+                i++;
+            }
+            return i;
+        }
+
+        /// @brief search() without the match statistics
+        std::vector<std::pair<size_t, size_t>> run_search(const char *text, size_t len) const{
+            std::vector<std::pair<size_t, size_t>> result;
+            if(!this->search_dm){
+                std::string err = "FA was compiled without search support, see FACompiler::set_search";
+                throw err;
+            }
+            if(!required_literal.empty() && !contains_required_literal(text, len)){
+                return result;
+            }
+
+            // Forward pass: end of the last match
+            const DMachine &forward = *this->search_dm;
+            const size_t NONE = (size_t)-1;
+            bool skip = !forward.is_final(forward.start);
+            size_t last_end = skip ? NONE : 0;
+            uint32_t state = forward.start;
+            size_t i = 0;
+            while(i < len){
+                if(skip && state == forward.start){
+                    i = skip_to_first_byte(text, i, len);
+                    if(i == len) break;
+                }
+                state = forward.trans[state*forward.num_classes + forward.byte_class[(unsigned char)text[i]]];
+                i++;
+                if(forward.is_final(state)){
+                    last_end = i;
+                }
+            }
+            if(last_end == NONE){
+                return result;
+            }
+
+            // Reverse pass: starts[j] is set when a match starts at j
+            const DMachine &reverse = *this->reverse_dm;
+            std::vector<uint64_t> starts(last_end/64 + 1, 0);
+            state = reverse.start;
+            if(reverse.is_final(state)){
+                starts[last_end >> 6] |= (uint64_t)1 << (last_end & 63);
+            }
+            for(size_t j = last_end; j>0; j--){
+                state = reverse.trans[state*reverse.num_classes + reverse.byte_class[(unsigned char)text[j - 1]]];
+                if(reverse.is_final(state)){
+                    starts[(j - 1) >> 6] |= (uint64_t)1 << ((j - 1) & 63);
+                }
+            }
+
+            // Longest match from each leftmost start, the next search begins where the match ended.
+            // Scans from two starts that are in the same state at the same position agree from there on, so
+            // seen_state[p] keeps the state of the last scan through position p and seen_end[p] the furthest
+            // match end that scan found at or after p. A later scan reaching that state at p stops there instead
+            // of reading the same input again, which keeps match-dense input such as a+(a+b)*.c over aaa... linear.
+            const DMachine &anchored = *this->dm;
+            std::vector<uint32_t> seen_state(last_end + 1, DMachine::NO_STATE);
+            std::vector<size_t> seen_end(last_end + 1, NONE);
+            size_t pos = 0;
+            while(pos <= last_end){
+                size_t w = pos >> 6;
+                uint64_t bits = starts[w] & (~(uint64_t)0 << (pos & 63));
+                while(bits == 0 && ++w < starts.size()){
+                    bits = starts[w];
+                }
+                if(bits == 0) break;
+                size_t begin = w*64 + __builtin_ctzll(bits);
+
+                state = anchored.start;
+                size_t stop = begin;
+                bool joined = false;
+                while(stop < last_end && state != anchored.dead){
+                    state = anchored.trans[state*anchored.num_classes + anchored.byte_class[(unsigned char)text[stop]]];
+                    stop++;
+                    if(seen_state[stop] == state){
+                        joined = true;
+                        break;
+                    }
+                    seen_state[stop] = state;
+                }
+                size_t furthest = joined ? seen_end[stop] : NONE;
+                for(size_t p = joined ? stop - 1 : stop; p>begin; p--){
+                    if(furthest == NONE && anchored.is_final(seen_state[p])){
+                        furthest = p;
+                    }
+                    seen_end[p] = furthest;
+                }
+                size_t end = (furthest == NONE) ? begin : furthest;
+                result.push_back({begin, end});
+                pos = end > begin ? end : begin + 1;
+            }
+
+            return result;
+        }
+
+        /// @brief check() without the match statistics
+        bool run_check(const char *s, size_t len) const{
+            if(options.mode == FAMode::LAZY_DFA){
+                return this->ldm->accepted(s, len);
+            }
+            if(options.mode == FAMode::NFA){
+                return this->ndm->accepted(s, len);
+            }
+            return this->dm->accepted(s, len);
+        }
+
+        /// @brief Checks the records get(i) = (pointer, length) for i in [0, count) in tasks of BATCH_TASK records,
+        /// each task owns whole result words. In DFA mode a task runs the interleaved kernel of DMachine.
+        template<typename F>
+        std::vector<uint64_t> check_batch(size_t count, ThreadPool &pool, F get) const{
+            const size_t BATCH_TASK = 1024;
+            std::vector<uint64_t> result((count + 63)/64, 0);
+            int tasks = (count + BATCH_TASK - 1)/BATCH_TASK;
+            pool.parallel_for(tasks, [&](int task){
+                size_t begin = task*BATCH_TASK;
+                size_t end = std::min(count, begin + BATCH_TASK);
+                auto put = [&](size_t i, bool accepted){
+                    if(accepted){
+                        result[i >> 6] |= (uint64_t)1 << (i & 63);
+                    }
+                };
+                if(options.mode == FAMode::DFA){
+                    // Interleaving only pays off once strings are long enough to amortize the lane refills
+                    size_t bytes = 0;
+                    for(size_t i = begin; i<end; i++){
+                        bytes += get(i).second;
+                    }
+                    if(bytes >= (end - begin)*DMachine::INTERLEAVE_MIN_LENGTH){
+                        this->dm->accepted_interleaved<DMachine::LANES>(begin, end, get, put);
+                        return;
+                    }
+                }
+                for(size_t i = begin; i<end; i++){
+                    std::pair<const char*, size_t> record = get(i);
+                    put(i, run_check(record.first, record.second));
+                }
+            });
+
+            if(match_stats){
+                uint64_t accepted = 0, bytes = 0;
+                for(uint64_t word: result){
+                    for(; word; word &= word - 1){
+                        accepted++;
+                    }
+                }
+                for(size_t i = 0; i<count; i++){
+                    bytes += get(i).second;
+                }
+                match_stats->add(count, accepted, bytes);
+            }
+            return result;
+        }
+
+        /// @brief Builds the machines of the selected mode from regex, or from patterns when it is not empty
+        void build(){
+            this->nd_state_id = 0;
+
+            auto begin = std::chrono::steady_clock::now();
+            construct_NFA();
+            statistics.nfa_seconds = seconds_since(begin);
+
+            begin = std::chrono::steady_clock::now();
+            this->ndm->index_states(nd_state_id);
+            if(options.mode == FAMode::NFA){
+                this->ndm->index_bit_parallel();
+            }
+            statistics.index_seconds = seconds_since(begin);
+            statistics.index_bytes = this->ndm->memory_bytes();
+            statistics.byte_classes = this->ndm->symbols.size();
+            for(auto& state: this->ndm->states){
+                statistics.closures += state != nullptr;
+            }
+
+            if(options.mode == FAMode::LAZY_DFA){
+                this->ldm = std::make_unique<LazyDMachine>(this->ndm.get(), options.lazy_cache_bytes);
+            }
+            else if(options.mode == FAMode::DFA){
+                begin = std::chrono::steady_clock::now();
+                construct_DFA();
+                statistics.dfa_seconds = seconds_since(begin);
+                statistics.dfa_bytes = statistics.subset_table_bytes + this->dm->memory_bytes();
+                statistics.dfa_states = statistics.min_dfa_states = this->dm->num_states;
+                if(options.minimize){
+                    begin = std::chrono::steady_clock::now();
+                    minimize_DFA();
+                    statistics.minimize_seconds = seconds_since(begin);
+                    statistics.min_dfa_states = this->dm->num_states;
+                }
+            }
+
+            if(options.search){
+                // Search DFAs are accounted to the search phase alone
+                FAStats before = statistics;
+                begin = std::chrono::steady_clock::now();
+                construct_search();
+                statistics.search_seconds = seconds_since(begin);
+                statistics.search_bytes = nodes_bytes(rev_nodes) + this->rev_ndm->memory_bytes()
+                                          + this->search_dm->memory_bytes() + this->reverse_dm->memory_bytes()
+                                          + statistics.subset_table_bytes - before.subset_table_bytes
+                                          + statistics.minimize_bytes - before.minimize_bytes;
+                if(before.dfa_states == 0){
+                    statistics.search_bytes += this->dm->memory_bytes();
+                }
+                statistics.closure_merges = before.closure_merges;
+                statistics.subsets = before.subsets;
+                statistics.subset_table_bytes = before.subset_table_bytes;
+                statistics.minimize_bytes = before.minimize_bytes;
+            }
+
+            // Matching a DFA only reads its tables, the NFA is kept for the lazy and NFA modes alone.
+            // The reversed NFA was only needed to build reverse_dm.
+            if(options.mode == FAMode::DFA){
+                this->ndm.reset();
+                nd_nodes.clear();
+                nd_nodes.shrink_to_fit();
+            }
+            this->rev_ndm.reset();
+            rev_nodes.clear();
+            rev_nodes.shrink_to_fit();
+        }
+
+        /// @brief Product DFA of a and b, or the complement of a when b is null
+        /// Pairs of operand states are numbered in BFS order from the start pair, so only the reachable ones get a row.
+        /// A byte class of the product is a pair of operand classes. Bytes outside the alphabet lead to a sink state of
+        /// their own, which never accepts even where the operand dead state does, as it does for a complement.
+        static FA build_product(const FA &a, const FA *b, FASetOp op, bool minimize){
+            auto begin = std::chrono::steady_clock::now();
+            FA fa;
+            fa.nullchar = a.nullchar;
+            fa.nd_state_id = 0;
+            fa.options.mode = FAMode::DFA;
+            fa.options.minimize = minimize;
+            // The strings a result can accept are over the intersection, the union or the first of the alphabets
+            fa.alphabet = a.alphabet;
+            if(b != nullptr && op != FASetOp::DIFFERENCE){
+                std::string merged;
+                if(op == FASetOp::INTERSECTION){
+                    std::set_intersection(a.alphabet.begin(), a.alphabet.end(), b->alphabet.begin(), b->alphabet.end(),
+                                          std::back_inserter(merged));
+                }
+                else{
+                    std::set_union(a.alphabet.begin(), a.alphabet.end(), b->alphabet.begin(), b->alphabet.end(),
+                                   std::back_inserter(merged));
+                }
+                fa.alphabet = merged;
+            }
+
+            // FAs compiled in the lazy and NFA modes have no table, theirs is built here over their own alphabet.
+            // Only the product gathers the statistics of that subset construction, the operands are left as they are.
+            std::unique_ptr<DMachine> built_a, built_b;
+            auto operand_dfa = [&](const FA &operand, std::unique_ptr<DMachine> &built) -> const DMachine* {
+                if(operand.dm){
+                    return operand.dm.get();
+                }
+                built = fa.subset_construction(operand.ndm.get(), operand.alphabet, false);
+                return built.get();
+            };
+            const DMachine *ma = operand_dfa(a, built_a);
+            const DMachine *mb = (b != nullptr) ? operand_dfa(*b, built_b) : nullptr;
+
+            std::unique_ptr<DMachine> machine = std::make_unique<DMachine>();
+            std::fill(machine->byte_class, machine->byte_class + 256, 0);
+            std::map<std::pair<int, int>, int> class_ids;
+            std::vector<std::pair<int, int>> class_pairs = {{0, 0}};
+            for(auto& c: fa.alphabet){
+                std::pair<int, int> classes = {ma->byte_class[(unsigned char)c], mb ? mb->byte_class[(unsigned char)c] : 0};
+                auto it = class_ids.find(classes);
+                if(it == class_ids.end()){
+                    it = class_ids.insert({classes, class_pairs.size()}).first;
+                    class_pairs.push_back(classes);
+                }
+                machine->byte_class[(unsigned char)c] = it->second;
+            }
+            int k = class_pairs.size();
+
+            std::unordered_map<uint64_t, uint32_t> pair_ids;
+            std::vector<std::pair<uint32_t, uint32_t>> pairs;
+            std::vector<uint32_t> table;
+            auto intern = [&](uint32_t p, uint32_t q){
+                uint64_t key = ((uint64_t)p << 32) | q;
+                auto it = pair_ids.find(key);
+                if(it != pair_ids.end()){
+                    return it->second;
+                }
+                uint32_t id = pairs.size();
+                pair_ids[key] = id;
+                pairs.push_back({p, q});
+                return id;
+            };
+            intern(ma->start, mb ? mb->start : 0);
+            for(uint32_t cur = 0; cur<pairs.size(); cur++){
+                table.resize((cur + 1)*k);
+                for(int c = 1; c<k; c++){
+                    uint32_t p = ma->trans[pairs[cur].first*ma->num_classes + class_pairs[c].first];
+                    uint32_t q = mb ? mb->trans[pairs[cur].second*mb->num_classes + class_pairs[c].second] : 0;
+                    table[cur*k + c] = intern(p, q);
+                }
+            }
+            uint32_t sink = pairs.size();
+            table.resize((sink + 1)*k, sink);
+            for(uint32_t cur = 0; cur<sink; cur++){
+                table[cur*k] = sink;
+            }
+
+            machine->alphabet = fa.alphabet;
+            machine->num_classes = k;
+            machine->num_states = sink + 1;
+            machine->start = 0;
+            machine->dead = sink;
+            machine->table = std::move(table);
+            machine->final_states.assign(((size_t)sink + 1 + 63)/64, 0);
+            for(uint32_t state = 0; state<sink; state++){
+                bool in_a = ma->is_final(pairs[state].first);
+                bool in_b = mb && mb->is_final(pairs[state].second);
+                bool accepted;
+                if(mb == nullptr){
+                    accepted = !in_a;
+                }
+                else if(op == FASetOp::INTERSECTION){
+                    accepted = in_a && in_b;
+                }
+                else if(op == FASetOp::UNION){
+                    accepted = in_a || in_b;
+                }
+                else{
+                    accepted = in_a && !in_b;
+                }
+                if(accepted){
+                    machine->final_states[state >> 6] |= (uint64_t)1 << (state & 63);
+                }
+            }
+            machine->bind();
+
+            fa.dm = std::move(machine);
+            fa.statistics.byte_classes = k;
+            fa.statistics.dfa_seconds = seconds_since(begin);
+            // Interned pairs: the pair and about four words of hash node and bucket
+            fa.statistics.dfa_bytes = fa.dm->memory_bytes() + pairs.size()*(sizeof(pairs[0]) + 4*sizeof(void*));
+            fa.statistics.dfa_states = fa.statistics.min_dfa_states = fa.dm->num_states;
+            if(minimize){
+                begin = std::chrono::steady_clock::now();
+                fa.minimize_DFA();
+                fa.statistics.minimize_seconds = seconds_since(begin);
+                fa.statistics.min_dfa_states = fa.dm->num_states;
+            }
+            return fa;
+        }
+
+    public:
+        FA(){
+
+        }
+
+        FA(const std::string &s, const std::string &alphabet, char nullchar, const FAOptions &options = FAOptions()){
+            this->regex = s;
+            this->alphabet = alphabet;
+            this->nullchar = nullchar;
+            this->options = options;
+            build();
+        }
+
+        /// @brief Builds one automaton for a set of postfix regexes, matches() tells which of them accept a string
+        /// check() and search() treat the set as the union of its patterns.
+        FA(const std::vector<std::string> &patterns, const std::string &alphabet, char nullchar, const FAOptions &options = FAOptions()){
+            if(patterns.empty()){
+                std::string err = "FA needs at least one pattern";
+                throw err;
+            }
+            this->patterns = patterns;
+            // The union in postfix, read by extract_prefilter()
+            this->regex = patterns[0];
+            for(int i = 1; i<(int)patterns.size(); i++){
+                this->regex += patterns[i] + "+";
+            }
+            this->alphabet = alphabet;
+            this->nullchar = nullchar;
+            this->options = options;
+            build();
+        }
+
+        // Nodes are shared by pointer between the arena and the machines, so an FA can be moved but not copied
+        FA(FA &&other) = default;
+        FA& operator=(FA &&other) = default;
+        FA(const FA &other) = delete;
+        FA& operator=(const FA &other) = delete;
+
+        /// @brief Writes the compiled DFA (alphabet, transition table, final states, start state) to a file
+        /// The file can be loaded back with FA::load. Only FAMode::DFA machines have a table to save.
+        void save(const std::string &path) const{
+            if(options.mode != FAMode::DFA){
+                std::string err = "Only DFA mode FA can be saved";
+                throw err;
+            }
+            if(!patterns.empty()){
+                std::string err = "Multi-pattern FA cannot be saved";
+                throw err;
+            }
+            const DMachine &machine = *this->dm;
+
+            DFAFileHeader header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, DFAFileHeader::MAGIC, sizeof(header.magic));
+            header.version = DFAFileHeader::VERSION;
+            header.byte_order = DFAFileHeader::ORDER_MARK;
+            header.num_states = machine.num_states;
+            header.num_classes = machine.num_classes;
+            header.start = machine.start;
+            header.dead = machine.dead;
+            header.alphabet_size = machine.alphabet.size();
+            header.nullchar = (unsigned char)this->nullchar;
+            std::copy(machine.byte_class, machine.byte_class + 256, header.byte_class);
+
+            std::string file(header.file_size(), '\0');
+            std::memcpy(&file[header.alphabet_offset()], machine.alphabet.data(), machine.alphabet.size());
+            std::memcpy(&file[header.table_offset()], machine.trans, machine.table_size*sizeof(uint32_t));
+            std::memcpy(&file[header.final_offset()], machine.accept,
+                        ((size_t)machine.num_states + 63)/64*sizeof(uint64_t));
+            std::memcpy(&file[0], &header, sizeof(header));
+            header.checksum = header.compute_checksum(file.data(), file.size());
+            std::memcpy(&file[0], &header, sizeof(header));
+
+            std::ofstream out(path, std::ios::binary);
+            out.write(file.data(), file.size());
+            out.close();
+            if(!out){
+                std::string err = "Cannot write file " + path;
+                throw err;
+            }
+        }
+
+        /// @brief Writes standalone C++ source of a matcher accepting the same strings as check()
+        /// The source defines inline bool name(const char*, size_t) and bool name(const std::string&) and needs
+        /// nothing but the standard library, see DMachine::generate_cpp. Only FAMode::DFA machines can generate it.
+        void generate_cpp(std::ostream &out, const std::string &name) const{
+            if(options.mode != FAMode::DFA){
+                std::string err = "Only DFA mode FA can generate code";
+                throw err;
+            }
+            bool identifier = !name.empty() && !(name[0] >= '0' && name[0] <= '9');
+            for(auto& c: name){
+                identifier = identifier && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_');
+            }
+            if(!identifier){
+                std::string err = name + " is not a valid C++ function name";
+                throw err;
+            }
+
+            out << "// Generated matcher, " << this->dm->num_states << " DFA states";
+            if(!regex.empty()){
+                // Runs of the alphabet are written as postfix operands, which keeps the comment printable
+                std::string runs;
+                for(size_t i = 0, j; i<alphabet.size(); i = j){
+                    for(j = i + 1; j<alphabet.size() && (unsigned char)alphabet[j] == (unsigned char)alphabet[j - 1] + 1; j++);
+                    write_postfix_range(runs, alphabet[i], alphabet[j - 1], nullchar);
+                }
+                out << ", postfix regex " << regex << " over alphabet " << runs;
+            }
+            out << std::endl;
+            out << "#include <cstddef>" << std::endl;
+            out << "#include <string>" << std::endl;
+            out << std::endl;
+            this->dm->generate_cpp(out, name);
+        }
+
+        /// @brief Loads a DFA written by FA::save
+        /// The file is mapped read-only and matched in place, without copying the table, so processes loading the
+        /// same file share its pages. The returned FA checks, traces and streams like a DFA mode FA, but cannot
+        /// search or print its regex.
+        /// @param verify check the checksum and every transition, which reads the whole file once. Skip it only for
+        /// trusted files, a corrupt table is not detected otherwise
+        static FA load(const std::string &path, bool verify = true){
+            std::unique_ptr<DMachine> machine = std::make_unique<DMachine>();
+            const char *data;
+            size_t len;
+#ifdef _WIN32
+            std::ifstream in(path, std::ios::binary | std::ios::ate);
+            if(!in){
+                std::string err = "Cannot open file " + path;
+                throw err;
+            }
+            len = in.tellg();
+            in.seekg(0);
+            // Read into 8-byte words so that the table and bitmap inside are aligned as in a mapping
+            std::shared_ptr<std::vector<uint64_t>> buffer = std::make_shared<std::vector<uint64_t>>((len + 7)/8);
+            in.read((char*)buffer->data(), len);
+            if(!in){
+                std::string err = "Cannot read file " + path;
+                throw err;
+            }
+            data = (const char*)buffer->data();
+            machine->mapping = buffer;
+#else
+            int fd = open(path.c_str(), O_RDONLY);
+            if(fd < 0){
+                std::string err = "Cannot open file " + path;
+                throw err;
+            }
+            struct stat info;
+            if(fstat(fd, &info) != 0){
+                close(fd);
+                std::string err = "Cannot stat file " + path;
+                throw err;
+            }
+            len = info.st_size;
+            if(len < sizeof(DFAFileHeader)){
+                close(fd);
+                std::string err = path + " is not a DFA file";
+                throw err;
+            }
+            void *mapped = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if(mapped == MAP_FAILED){
+                std::string err = "Cannot map file " + path;
+                throw err;
+            }
+            data = (const char*)mapped;
+            machine->mapping = std::shared_ptr<const void>(mapped, [len](const void *p){
+                munmap((void*)p, len);
+            });
+#endif
+
+            DFAFileHeader header;
+            if(len < sizeof(header)){
+                std::string err = path + " is not a DFA file";
+                throw err;
+            }
+            std::memcpy(&header, data, sizeof(header));
+            if(std::memcmp(header.magic, DFAFileHeader::MAGIC, sizeof(header.magic)) != 0){
+                std::string err = path + " is not a DFA file";
+                throw err;
+            }
+            if(header.byte_order != DFAFileHeader::ORDER_MARK){
+                std::string err = path + " was written on a machine with a different byte order";
+                throw err;
+            }
+            if(header.version != DFAFileHeader::VERSION){
+                std::string err = path + " has DFA file version " + std::to_string(header.version) + ", expected "
+                                  + std::to_string(DFAFileHeader::VERSION);
+                throw err;
+            }
+            bool valid = header.num_states > 0 && header.num_classes > 0 && header.num_classes <= 256
+                         && header.start < header.num_states
+                         && (header.dead < header.num_states || header.dead == DMachine::NO_STATE)
+                         && header.file_size() == len;
+            for(int b = 0; valid && b<256; b++){
+                valid = header.byte_class[b] < header.num_classes;
+            }
+            if(!valid){
+                std::string err = path + " has an invalid DFA header";
+                throw err;
+            }
+
+            machine->alphabet.assign(data + header.alphabet_offset(), header.alphabet_size);
+            std::copy(header.byte_class, header.byte_class + 256, machine->byte_class);
+            machine->num_classes = header.num_classes;
+            machine->num_states = header.num_states;
+            machine->start = header.start;
+            machine->dead = header.dead;
+            machine->trans = (const uint32_t*)(data + header.table_offset());
+            machine->accept = (const uint64_t*)(data + header.final_offset());
+            machine->table_size = (size_t)header.num_states*header.num_classes;
+
+            if(verify){
+                if(header.compute_checksum(data, len) != header.checksum){
+                    std::string err = path + " is corrupt, checksum mismatch";
+                    throw err;
+                }
+                for(size_t i = 0; i<machine->table_size; i++){
+                    if(machine->trans[i] >= header.num_states){
+                        std::string err = path + " has a transition to a state out of range";
+                        throw err;
+                    }
+                }
+                // The table is read once here anyway, an unverified one is matched without the exit shortcuts
+                machine->mark_exits();
+            }
+
+            FA fa;
+            fa.alphabet = machine->alphabet;
+            fa.nullchar = (char)header.nullchar;
+            fa.nd_state_id = 0;
+            fa.options.mode = FAMode::DFA;
+            fa.dm = std::move(machine);
+            return fa;
+        }
+
+        /// @brief DFA mode FA accepting the strings of the set operation op on a and b, matched in one pass
+        /// The product is explored from the pair of start states, so only reachable pairs are built, and then
+        /// minimized unless minimize is false. Operands may be of any mode, loaded or results of product() and
+        /// complement() themselves, and patterns of a multi-pattern FA count as their union. The result cannot
+        /// search or print its regex.
+        static FA product(const FA &a, const FA &b, FASetOp op, bool minimize = true){
+            return build_product(a, &b, op, minimize);
+        }
+
+        /// @brief DFA mode FA accepting the strings over the alphabet of a that a rejects, see product()
+        /// A string with a byte outside the alphabet is still rejected.
+        static FA complement(const FA &a, bool minimize = true){
+            return build_product(a, nullptr, FASetOp::INTERSECTION, minimize);
+        }
+
+        void print_transition_table(){
+            if(options.mode == FAMode::NFA){
+                std::cout << "Transition table of NFA" << std::endl;
+                this->ndm->print_machine_table();
+                return;
+            }
+            std::cout << "Transition table of DFA" << std::endl;
+            if(options.mode == FAMode::LAZY_DFA){
+                this->ldm->print_machine_table();
+                return;
+            }
+            this->dm->print_machine_table();
+        }
+
+        bool check(const std::string &s) const{
+            return check(s.data(), s.size());
+        }
+
+        /// @brief Thread-safe, the same FA can be checked from any number of threads
+        bool check(const char *s, size_t len) const{
+            bool accepted = run_check(s, len);
+            if(match_stats){
+                match_stats->add(1, accepted, len);
+            }
+            return accepted;
+        }
+
+        /// @brief Counts every call, accepted string and byte matched from now on into stats, nullptr stops counting
+        /// stats must outlive the matching calls. FAStream counts the bytes fed and one call per finish().
+        void set_match_stats(FAMatchStats *stats){
+            this->match_stats = stats;
+        }
+
+        /// @brief The regex in the postfix form it was compiled from
+        const std::string& postfix() const{
+            return regex;
+        }
+
+        /// @brief Phase timings and automaton sizes measured while compiling this FA
+        const FAStats& stats() const{
+            return statistics;
+        }
+
+        /// @brief Bytes held by the machines this FA keeps for matching, without the lazy DFA cache
+        /// A DFA mode FA keeps its tables alone, the NFA and its index only stay for the lazy and NFA modes.
+        size_t memory_bytes() const{
+            size_t bytes = 0;
+            if(this->ndm){
+                bytes += nodes_bytes(nd_nodes) + this->ndm->memory_bytes();
+            }
+            for(const DMachine *machine: {this->dm.get(), this->search_dm.get(), this->reverse_dm.get()}){
+                if(machine){
+                    bytes += machine->memory_bytes();
+                }
+            }
+            return bytes;
+        }
+
+        /// @brief Number of patterns compiled into this FA, 1 for a single regex
+        int pattern_count() const{
+            return patterns.empty() ? 1 : patterns.size();
+        }
+
+        std::vector<int> matches(const std::string &s) const{
+            return matches(s.data(), s.size());
+        }
+
+        /// @brief Ids of the patterns that accept s, in increasing order, in a single pass over s
+        /// Pattern ids are positions in the list given to FACompiler::compile_set, a single regex is pattern 0.
+        std::vector<int> matches(const char *s, size_t len) const{
+            std::vector<int> result;
+            if(patterns.empty()){
+                if(run_check(s, len)){
+                    result.push_back(0);
+                }
+            }
+            else if(options.mode == FAMode::DFA){
+                result = this->dm->patterns(this->dm->run(this->dm->start, s, len));
+            }
+            else{
+                StateSet current = this->ndm->start_closure();
+                if(options.mode == FAMode::LAZY_DFA){
+                    this->ldm->run(current, s, len);
+                }
+                else{
+                    this->ndm->run(current, s, len);
+                }
+                result = this->ndm->patterns_in(current);
+            }
+            if(match_stats){
+                match_stats->add(1, !result.empty(), len);
+            }
+            return result;
+        }
+
+        /// @brief Checks count strings on the thread pool
+        /// @return bitmap, bit i (word i/64, bit i%64) is set when strings[i] is accepted
+        std::vector<uint64_t> check_batch(const std::string *strings, size_t count, ThreadPool &pool = ThreadPool::shared()) const{
+            return check_batch(count, pool, [&](size_t i){
+                return std::make_pair(strings[i].data(), strings[i].size());
+            });
+        }
+
+        /// @brief Checks count records given as (offset, length) pairs into one buffer on the thread pool
+        /// @return bitmap, bit i (word i/64, bit i%64) is set when record i is accepted
+        std::vector<uint64_t> check_batch(const char *buffer, const std::pair<size_t, size_t> *spans, size_t count, ThreadPool &pool = ThreadPool::shared()) const{
+            return check_batch(count, pool, [&](size_t i){
+                return std::make_pair((const char*)buffer + spans[i].first, spans[i].second);
+            });
+        }
+
+        bool check_parallel(const std::string &s, ThreadPool &pool = ThreadPool::shared()) const{
+            return check_parallel(s.data(), s.size(), pool);
+        }
+
+        /// @brief Checks one large input on the thread pool by speculative chunked execution
+        /// The input is split into chunks. The first runs from the start state; every other chunk is run from all
+        /// DFA states at once (DMachine::run_all), giving a state-to-state map per chunk. Composing the maps in
+        /// order yields the final state. Only FAMode::DFA runs in parallel, small inputs and the other modes are
+        /// checked sequentially.
+        bool check_parallel(const char *s, size_t len, ThreadPool &pool = ThreadPool::shared()) const{
+            const size_t PARALLEL_MIN_CHUNK = 1 << 20;
+            if(options.mode != FAMode::DFA || pool.size() == 1 || len < 2*PARALLEL_MIN_CHUNK){
+                return check(s, len);
+            }
+
+            int chunks = std::min((size_t)pool.size()*4, len/PARALLEL_MIN_CHUNK);
+            size_t chunk = (len + chunks - 1)/chunks;
+            std::vector<std::vector<uint32_t>> maps(chunks);
+            uint32_t state = this->dm->start;
+            pool.parallel_for(chunks, [&](int j){
+                size_t begin = j*chunk;
+                size_t end = std::min(len, begin + chunk);
+                if(j == 0){
+                    state = this->dm->run(state, s, end);
+                }
+                else{
+                    this->dm->run_all(s + begin, end - begin, maps[j]);
+                }
+            });
+            for(int j = 1; j<chunks; j++){
+                state = maps[j][state];
+            }
+            bool accepted = this->dm->is_final(state);
+            if(match_stats){
+                match_stats->add(1, accepted, len);
+            }
+
+            return accepted;
+        }
+
+        std::vector<std::pair<size_t, size_t>> search(const std::string &text) const{
+            return search(text.data(), text.size());
+        }
+
+        /// @brief Finds the leftmost-longest, non-overlapping matches of the regex inside text
+        /// A required literal is looked up first, then a forward pass with the unanchored DFA (skipping ahead to
+        /// bytes that can start a match whenever it sits in its start state) finds where the last match ends. A
+        /// reverse pass from there marks every position where a match starts, and the anchored DFA extends each
+        /// leftmost start to its longest match. The FA must be compiled with FACompiler::set_search(true).
+        /// @return [start, end) byte offsets of every match, in order
+        std::vector<std::pair<size_t, size_t>> search(const char *text, size_t len) const{
+            std::vector<std::pair<size_t, size_t>> result = run_search(text, len);
+            if(match_stats){
+                match_stats->add(1, !result.empty(), len);
+            }
+            return result;
+        }
+
+        std::vector<int> trace_states(const std::string &s) const{
+            if(options.mode == FAMode::LAZY_DFA){
+                return this->ldm->trace_states(s);
+            }
+            if(options.mode == FAMode::NFA){
+                std::string err = "State trace needs a DFA, FA was compiled in NFA mode";
+                throw err;
+            }
+            return this->dm->trace_states(s);
+        }
+
+        /// @brief Matches s and calls visit(state) for the start state and the state after each byte, in one pass
+        /// Nothing is allocated. Tracing stops at the first byte outside the alphabet, which rejects s.
+        /// @return whether s is accepted
+        template<typename Visit>
+        bool trace(const char *s, size_t len, Visit visit) const{
+            bool accepted;
+            if(options.mode == FAMode::LAZY_DFA){
+                accepted = this->ldm->trace(s, len, visit);
+            }
+            else if(options.mode == FAMode::NFA){
+                std::string err = "State trace needs a DFA, FA was compiled in NFA mode";
+                throw err;
+            }
+            else{
+                accepted = this->dm->trace(s, len, visit);
+            }
+            if(match_stats){
+                match_stats->add(1, accepted, len);
+            }
+            return accepted;
+        }
+
+        bool trace(const std::string &s, std::vector<int> &states) const{
+            return trace(s.data(), s.size(), states);
+        }
+
+        /// @brief Matches s and writes its state trace into states, reusing its capacity
+        bool trace(const char *s, size_t len, std::vector<int> &states) const{
+            states.clear();
+            return trace(s, len, [&](int state){
+                states.push_back(state);
+            });
+        }
+
+        bool trace_runs(const std::string &s, std::vector<std::pair<int, size_t>> &runs) const{
+            return trace_runs(s.data(), s.size(), runs);
+        }
+
+        /// @brief Matches s and writes its state trace run-length compressed into runs, reusing its capacity
+        /// Each run is a (state, count) pair of a state repeated count times in a row, as a self-loop produces, so
+        /// the trace of a long input stays as small as the number of state changes.
+        bool trace_runs(const char *s, size_t len, std::vector<std::pair<int, size_t>> &runs) const{
+            runs.clear();
+            return trace(s, len, [&](int state){
+                if(!runs.empty() && runs.back().first == state){
+                    runs.back().second++;
+                }
+                else{
+                    runs.push_back({state, 1});
+                }
+            });
+        }
+
+};
+
+/// @brief Resumable matcher over a compiled FA.
+/// Input is fed in chunks of any size and only the current state is kept between calls, a DFA state id for
+/// FAMode::DFA and the current NFA subset for the other modes. The FA must outlive the stream.
+class FAStream{
+    private:
+        const FA *fa;
+        uint32_t state;
+        StateSet subset;
+
+    public:
+        static const size_t READ_SIZE = 1 << 20;
+
+        FAStream(const FA &fa){
+            this->fa = &fa;
+            reset();
+        }
+
+        /// @brief Starts over from the start state
+        void reset(){
+            if(fa->options.mode == FAMode::DFA){
+                state = fa->dm->start;
+            }
+            else{
+                subset = fa->ndm->start_closure();
+            }
+        }
+
+        void feed(const char *s, size_t len){
+            if(fa->options.mode == FAMode::DFA){
+                state = fa->dm->run(state, s, len);
+            }
+            else if(fa->options.mode == FAMode::LAZY_DFA){
+                fa->ldm->run(subset, s, len);
+            }
+            else{
+                fa->ndm->run(subset, s, len);
+            }
+            if(fa->match_stats){
+                fa->match_stats->add(0, 0, len);
+            }
+        }
+
+        /// @brief Feeds everything left in the stream, READ_SIZE bytes at a time
+        void feed(std::istream &in){
+            std::vector<char> buffer(READ_SIZE);
+            while(in){
+                in.read(buffer.data(), buffer.size());
+                feed(buffer.data(), in.gcount());
+            }
+        }
+
+        /// @brief Feeds the whole content of a file, memory mapped where the platform allows it
+        void feed_file(const std::string &path){
+#ifdef _WIN32
+            std::ifstream in(path, std::ios::binary);
+            if(!in){
+                std::string err = "Cannot open file " + path;
+                throw err;
+            }
+            feed(in);
+#else
+            int fd = open(path.c_str(), O_RDONLY);
+            if(fd < 0){
+                std::string err = "Cannot open file " + path;
+                throw err;
+            }
+            struct stat info;
+            if(fstat(fd, &info) != 0){
+                close(fd);
+                std::string err = "Cannot stat file " + path;
+                throw err;
+            }
+            size_t len = info.st_size;
+            if(len > 0){
+                void *data = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(data == MAP_FAILED){
+                    close(fd);
+                    std::string err = "Cannot map file " + path;
+                    throw err;
+                }
+                madvise(data, len, MADV_SEQUENTIAL);
+                feed((const char*)data, len);
+                munmap(data, len);
+            }
+            close(fd);
+#endif
+        }
+
+        /// @brief Whether all the input fed since the last reset() is accepted
+        bool finish() const{
+            bool accepted;
+            if(fa->options.mode == FAMode::DFA){
+                accepted = fa->dm->is_final(state);
+            }
+            else{
+                accepted = subset.intersects(fa->ndm->finals);
+            }
+            if(fa->match_stats){
+                fa->match_stats->add(1, accepted, 0);
+            }
+            return accepted;
+        }
+};
+
+const size_t FAStream::READ_SIZE;
+
+/// @brief Thread-safe LRU cache of compiled FAs handed out as shared immutable handles
+/// Every key has its own compile lock, so concurrent requests for a key that is not cached yet wait for one
+/// compilation instead of each compiling it. An entry evicted while in use stays alive in the handles held by callers.
+class FACache{
+    private:
+        struct Entry{
+            std::mutex compile_lock;
+            // Null until compiled, written and read under FACache::lock
+            std::shared_ptr<const FA> fa;
+            std::list<std::string>::iterator recency_pos;
+        };
+
+        std::mutex lock;
+        size_t capacity;
+        size_t hits;
+        size_t misses;
+        std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+        // Keys from most to least recently used
+        std::list<std::string> recency;
+
+        /// @brief Drops least recently used entries until the cache fits its capacity, lock must be held
+        void evict(){
+            while(entries.size() > capacity){
+                entries.erase(recency.back());
+                recency.pop_back();
+            }
+        }
+
+    public:
+        FACache(size_t capacity = 64){
+            this->capacity = capacity;
+            this->hits = 0;
+            this->misses = 0;
+        }
+
+        /// @brief Returns the FA cached under key, compiling it with build() if it is not cached
+        std::shared_ptr<const FA> get(const std::string &key, const std::function<FA()> &build){
+            std::shared_ptr<Entry> entry;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                auto it = entries.find(key);
+                if(it != entries.end()){
+                    entry = it->second;
+                    recency.splice(recency.begin(), recency, entry->recency_pos);
+                    if(entry->fa){
+                        hits++;
+                        return entry->fa;
+                    }
+                }
+                else if(capacity > 0){
+                    entry = std::make_shared<Entry>();
+                    recency.push_front(key);
+                    entry->recency_pos = recency.begin();
+                    entries[key] = entry;
+                    evict();
+                }
+                else{
+                    misses++;
+                }
+            }
+            if(!entry){
+                return std::make_shared<const FA>(build());
+            }
+
+            // Compiled outside the cache lock, so only requests for this key wait
+            std::lock_guard<std::mutex> compile_guard(entry->compile_lock);
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if(entry->fa){
+                    hits++;
+                    return entry->fa;
+                }
+                misses++;
+            }
+            std::shared_ptr<const FA> fa;
+            try{
+                fa = std::make_shared<const FA>(build());
+            }
+            catch(...){
+                // Do not keep a failed entry, the next request compiles again and reports the error
+                std::lock_guard<std::mutex> guard(lock);
+                auto it = entries.find(key);
+                if(it != entries.end() && it->second == entry){
+                    recency.erase(entry->recency_pos);
+                    entries.erase(it);
+                }
+                throw;
+            }
+
+            std::lock_guard<std::mutex> guard(lock);
+            entry->fa = fa;
+            return fa;
+        }
+
+        /// @brief Maximum number of cached FAs, 0 disables caching
+        void set_capacity(size_t capacity){
+            std::lock_guard<std::mutex> guard(lock);
+            this->capacity = capacity;
+            evict();
+        }
+
+        void clear(){
+            std::lock_guard<std::mutex> guard(lock);
+            entries.clear();
+            recency.clear();
+        }
+
+        size_t size(){
+            std::lock_guard<std::mutex> guard(lock);
+            return entries.size();
+        }
+
+        /// @brief Number of get() calls answered without compiling
+        size_t hit_count(){
+            std::lock_guard<std::mutex> guard(lock);
+            return hits;
+        }
+
+        /// @brief Number of get() calls that compiled
+        size_t miss_count(){
+            std::lock_guard<std::mutex> guard(lock);
+            return misses;
+        }
+};
+
+struct RegexNode;
+typedef std::shared_ptr<const RegexNode> RegexPtr;
+
+/// @brief Node of the syntax tree FACompiler parses a regex into
+/// Trees are immutable once built, so rewrites share the sub-trees they keep.
+struct RegexNode{
+    enum Kind{
+        EMPTY,      // the empty string
+        BYTES,      // one byte of ranges
+        LITERAL,    // exactly the string literal
+        CONCAT,     // the children one after another
+        UNION,      // any one of the children
+        REPEAT      // the only child min to max times, max is -1 when unbounded
+    };
+    Kind kind;
+    ByteRanges ranges;
+    std::string literal;
+    std::vector<RegexPtr> children;
+    int min = 0, max = 0;
+    // Operands the automaton builders create for the node, repetitions unrolled
+    size_t expanded = 1;
+    // Whether the node matches the empty string, how many operands the epsilon closure entering it reaches, and
+    // an estimate of the summed closure sizes of its states. Optional copies of a nullable operand can all be
+    // skipped through, so the closures of (a?.b?){n} add up to O(n^2) although it only has 2n operands.
+    bool nullable = false;
+    size_t reach = 1;
+    size_t closures = 1;
+
+    static RegexPtr empty(){
+        auto node = std::make_shared<RegexNode>();
+        node->kind = EMPTY;
+        node->nullable = true;
+        node->reach = 0;
+        return node;
+    }
+
+    static RegexPtr bytes(const ByteRanges &ranges){
+        auto node = std::make_shared<RegexNode>();
+        node->kind = BYTES;
+        node->ranges = ranges;
+        return node;
+    }
+
+    static RegexPtr string(const std::string &literal){
+        auto node = std::make_shared<RegexNode>();
+        node->kind = LITERAL;
+        node->literal = literal;
+        node->expanded = node->closures = literal.size();
+        return node;
+    }
+
+    /// @brief Concatenation or union of children, the child itself when there is only one
+    static RegexPtr join(Kind kind, const std::vector<RegexPtr> &children){
+        if(children.size() == 1) return children[0];
+        auto node = std::make_shared<RegexNode>();
+        node->kind = kind;
+        node->children = children;
+        node->expanded = 0;
+        node->closures = 0;
+        for(auto& child: children){
+            node->expanded += child->expanded;
+            node->closures += child->closures;
+        }
+        if(kind == UNION){
+            // The entry closure reaches into every alternative
+            node->nullable = false;
+            node->reach = 0;
+            for(auto& child: children){
+                node->nullable = node->nullable || child->nullable;
+                node->reach += child->reach;
+            }
+            node->closures += node->reach;
+        }
+        else{
+            // The closure leaving a child runs on through the nullable children after it
+            size_t tail = 0;
+            node->nullable = true;
+            for(int k = (int)children.size() - 1; k>=0; k--){
+                tail = children[k]->nullable ? children[k]->reach + tail : children[k]->reach;
+                node->nullable = node->nullable && children[k]->nullable;
+                if(k > 0) node->closures += tail;
+            }
+            node->reach = tail;
+        }
+        return node;
+    }
+
+    static RegexPtr repeat(const RegexPtr &child, int min, int max){
+        auto node = std::make_shared<RegexNode>();
+        node->kind = REPEAT;
+        node->children = {child};
+        node->min = min;
+        node->max = max;
+        // The builders make max copies, or min of them (at least one) looping on the last when unbounded
+        size_t copies = std::max(1, (max == -1) ? min : max);
+        node->expanded = child->expanded*copies;
+        node->nullable = min == 0 || child->nullable;
+        if(child->nullable){
+            // Every state may skip through all the copies after its own
+            node->reach = child->reach*copies;
+            node->closures = child->closures*copies + node->expanded*node->reach/2;
+        }
+        else{
+            node->reach = child->reach;
+            node->closures = (child->closures + child->reach + 1)*copies;
+        }
+        return node;
+    }
+
+    /// @brief Whether the node matches exactly one byte
+    bool single_byte() const{
+        return kind == BYTES && ranges.size() == 1 && ranges[0].first == ranges[0].second;
+    }
+
+    /// @brief Whether both trees have the same structure, which implies they match the same strings
+    bool same(const RegexNode &other) const{
+        if(kind != other.kind || min != other.min || max != other.max || ranges != other.ranges
+           || literal != other.literal || children.size() != other.children.size()) return false;
+        for(int i = 0; i<(int)children.size(); i++){
+            if(children[i] != other.children[i] && !children[i]->same(*other.children[i])) return false;
+        }
+        return true;
+    }
+};
+
+class FACompiler{
+    private:
+        std::string alphabet;
+        char nullchar;
+        FAOptions options;
+        FACache cache;
+        // Whether parsed regexes are rewritten by simplify() before compilation
+        bool simplify_regex = true;
+
+        typedef std::vector<std::pair<unsigned char, unsigned char>> ByteSequence;
+
+        bool in_alphabet(unsigned char lo, unsigned char hi){
+            for(int c = lo; c<=hi; c++){
+                if(!std::binary_search(this->alphabet.begin(), this->alphabet.end(), (char)c)) return false;
+            }
             return true;
         }
 
-        std::string infix_postfix(const std::string &s){
-            int sz = s.size();
-            std::string brackets = "()[]{}";
-            std::string biops = "+.";
-            std::string unops = "*";
+        /// @brief UTF-8 encoding of code point c into out
+        /// @return number of bytes written, 1 to 4
+        static int utf8_encode(uint32_t c, unsigned char *out){
+            if(c < 0x80){
+                out[0] = c;
+                return 1;
+            }
+            if(c < 0x800){
+                out[0] = 0xc0 | (c >> 6);
+                out[1] = 0x80 | (c & 0x3f);
+                return 2;
+            }
+            if(c < 0x10000){
+                out[0] = 0xe0 | (c >> 12);
+                out[1] = 0x80 | ((c >> 6) & 0x3f);
+                out[2] = 0x80 | (c & 0x3f);
+                return 3;
+            }
+            out[0] = 0xf0 | (c >> 18);
+            out[1] = 0x80 | ((c >> 12) & 0x3f);
+            out[2] = 0x80 | ((c >> 6) & 0x3f);
+            out[3] = 0x80 | (c & 0x3f);
+            return 4;
+        }
+
+        /// @brief Splits the code points [lo, hi], surrogates excluded, into sequences of byte ranges
+        /// A range is split until all its code points have the same encoded length and, for every continuation byte,
+        /// either share the bits above it or cover all of them. Its encodings are then exactly the byte strings
+        /// whose k-th byte lies between the k-th bytes of the encodings of lo and hi.
+        static void utf8_sequences(uint32_t lo, uint32_t hi, std::vector<ByteSequence> &result){
+            if(lo > hi) return;
+            if(lo < 0xd800 && hi > 0xdfff){
+                utf8_sequences(lo, 0xd7ff, result);
+                utf8_sequences(0xe000, hi, result);
+                return;
+            }
+            if(lo >= 0xd800 && lo <= 0xdfff) lo = 0xe000;
+            if(hi >= 0xd800 && hi <= 0xdfff) hi = 0xd7ff;
+            if(lo > hi) return;
+
+            const uint32_t length_ends[3] = {0x7f, 0x7ff, 0xffff};
+            for(int i = 0; i<3; i++){
+                if(lo <= length_ends[i] && hi > length_ends[i]){
+                    utf8_sequences(lo, length_ends[i], result);
+                    utf8_sequences(length_ends[i] + 1, hi, result);
+                    return;
+                }
+            }
+            for(int i = 1; i<4; i++){
+                uint32_t m = ((uint32_t)1 << (6*i)) - 1;
+                if((lo & ~m) == (hi & ~m)) continue;
+                if((lo & m) != 0){
+                    utf8_sequences(lo, lo | m, result);
+                    utf8_sequences((lo | m) + 1, hi, result);
+                    return;
+                }
+                if((hi & m) != m){
+                    utf8_sequences(lo, (hi & ~m) - 1, result);
+                    utf8_sequences(hi & ~m, hi, result);
+                    return;
+                }
+            }
+
+            unsigned char a[4], b[4];
+            int n = utf8_encode(lo, a);
+            utf8_encode(hi, b);
+            ByteSequence sequence;
+            for(int k = 0; k<n; k++){
+                sequence.push_back({a[k], b[k]});
+            }
+            result.push_back(sequence);
+        }
+
+        /// @brief Tree matching the UTF-8 encoding of any code point in [lo, hi]
+        RegexPtr code_point_node(uint32_t lo, uint32_t hi){
+            std::vector<ByteSequence> sequences;
+            utf8_sequences(lo, hi, sequences);
+            if(sequences.empty()){
+                std::string err = "Code point range of regular expression holds only surrogates";
+                throw err;
+            }
+            std::vector<RegexPtr> alternatives;
+            for(int i = 0; i<(int)sequences.size(); i++){
+                std::vector<RegexPtr> bytes;
+                for(int k = 0; k<(int)sequences[i].size(); k++){
+                    if(!in_alphabet(sequences[i][k].first, sequences[i][k].second)){
+                        std::string err = "FACompiler does not have the alphabet provided in regular expression";
+                        throw err;
+                    }
+                    bytes.push_back(RegexNode::bytes({sequences[i][k]}));
+                }
+                alternatives.push_back(RegexNode::join(RegexNode::CONCAT, bytes));
+            }
+            return RegexNode::join(RegexNode::UNION, alternatives);
+        }
+
+        /// @brief Reads the byte of the escape \xHH or \c starting at s[i], i is left on its last character
+        unsigned char read_escaped_byte(const std::string &s, size_t &i){
+            std::string err = "Invalid escape at position " + std::to_string(i) + " in regular expression";
+            i++;
+            if(i >= s.size()) throw err;
+            if(s[i] != 'x') return s[i];
+            if(i + 2 >= s.size() || hex_digit(s[i + 1]) < 0 || hex_digit(s[i + 2]) < 0) throw err;
+            i += 2;
+            return hex_digit(s[i - 1])*16 + hex_digit(s[i]);
+        }
+
+        /// @brief Reads the escape starting at s[i], i is left on its last character
+        /// \xHH is the byte HH, \u{H..} a code point and \u{H..-H..} a range of code points in UTF-8,
+        /// a backslash before any other character makes it a literal.
+        RegexPtr read_escape(const std::string &s, size_t &i){
+            size_t start = i;
+            auto fail = [&](){
+                std::string err = "Invalid escape at position " + std::to_string(start) + " in regular expression";
+                throw err;
+            };
+            auto read_hex = [&](int max_digits){
+                uint32_t value = 0;
+                int digits = 0;
+                while(i < s.size() && hex_digit(s[i]) >= 0 && digits < max_digits){
+                    value = value*16 + hex_digit(s[i++]);
+                    digits++;
+                }
+                if(digits == 0) fail();
+                return value;
+            };
+
+            if(i + 1 < s.size() && s[i + 1] == 'u'){
+                i += 2;
+                if(i >= s.size() || s[i] != '{') fail();
+                i++;
+                uint32_t lo = read_hex(6), hi = lo;
+                if(i < s.size() && s[i] == '-'){
+                    i++;
+                    hi = read_hex(6);
+                }
+                if(i >= s.size() || s[i] != '}' || lo > hi || hi > 0x10ffff) fail();
+                return code_point_node(lo, hi);
+            }
+            unsigned char b = read_escaped_byte(s, i);
+            if(!in_alphabet(b, b)){
+                std::string err = "FACompiler does not have the alphabet provided in regular expression";
+                throw err;
+            }
+            return RegexNode::bytes({{b, b}});
+        }
+
+        /// @brief Reads the class [...] starting at s[i], i is left on the ']'
+        /// Members are bytes or ranges a-b written plain or escaped, a ']' first is a member too.
+        /// [^...] takes the alphabet bytes not listed.
+        RegexPtr read_class(const std::string &s, size_t &i){
+            std::string err = "Invalid character class at position " + std::to_string(i) + " in regular expression";
+            bool member[256] = {false};
+            i++;
+            bool negated = i < s.size() && s[i] == '^';
+            if(negated) i++;
+            auto read_member = [&]() -> unsigned char {
+                if(i >= s.size()) throw err;
+                return (s[i] == '\\') ? read_escaped_byte(s, i) : s[i];
+            };
+            bool empty = true;
+            for(; i<s.size() && (s[i] != ']' || empty); i++){
+                unsigned char lo = read_member(), hi = lo;
+                if(i + 2 < s.size() && s[i + 1] == '-' && s[i + 2] != ']'){
+                    i += 2;
+                    hi = read_member();
+                }
+                if(lo > hi) throw err;
+                for(int c = lo; c<=hi; c++){
+                    member[c] = true;
+                }
+                empty = false;
+            }
+            if(i >= s.size() || empty) throw err;
+
+            for(int c = 0; c<256; c++){
+                if(member[c] && !negated && !in_alphabet(c, c)){
+                    std::string err = "FACompiler does not have the alphabet provided in regular expression";
+                    throw err;
+                }
+                member[c] = member[c] != negated && in_alphabet(c, c);
+            }
+            ByteRanges ranges = member_ranges(member);
+            if(ranges.empty()){
+                std::string err = "Character class of regular expression matches no byte of the alphabet";
+                throw err;
+            }
+            return RegexNode::bytes(ranges);
+        }
+
+        /// @brief Runs of the bytes set in member
+        static ByteRanges member_ranges(const bool *member){
+            ByteRanges ranges;
+            for(int c = 0; c<256; c++){
+                if(!member[c]) continue;
+                if(!ranges.empty() && ranges.back().second + 1 == c){
+                    ranges.back().second = c;
+                }
+                else{
+                    ranges.push_back({(unsigned char)c, (unsigned char)c});
+                }
+            }
+            return ranges;
+        }
+
+        /// @brief Reads the repetition {m}, {m,} or {m,n} starting at s[i] into min and max, i is left on the '}'
+        void read_repetition(const std::string &s, size_t &i, int &min, int &max){
+            std::string err = "Invalid repetition at position " + std::to_string(i) + " in regular expression";
+            auto read_number = [&](){
+                size_t begin = i;
+                int n = 0;
+                while(i < s.size() && s[i] >= '0' && s[i] <= '9' && n <= MAX_REPEAT){
+                    n = n*10 + (s[i++] - '0');
+                }
+                if(i == begin || n > MAX_REPEAT) throw err;
+                return n;
+            };
+            i++;
+            min = read_number();
+            max = min;
+            if(i < s.size() && s[i] == ','){
+                i++;
+                max = (i < s.size() && s[i] == '}') ? -1 : read_number();
+            }
+            if(i >= s.size() || s[i] != '}' || (max != -1 && max < min)) throw err;
+        }
+
+        static void syntax_error(const std::string &what, size_t i){
+            std::string err = what + " position " + std::to_string(i) + " in regular expression";
+            throw err;
+        }
 
-            std::string ans;
+        /// @brief Reports the character s[i] found after an operand where an operator or the end was expected
+        static void unexpected_after_operand(const std::string &s, size_t i){
+            if(std::string(")]}").find(s[i]) != std::string::npos){
+                syntax_error("Bracket mis-match at", i);
+            }
+            syntax_error("Missing operator before", i);
+        }
 
-            std::stack<char> operators;
-            for(int i = 0; i<sz; i++){
-                bool isBracket = false, isBiops = false, isUnops = false;
-                int bidx = -1;
-                for(int j = 0; j<6; j++){
-                    if(s[i] == brackets[j]){
-                        isBracket = true;
-                        bidx = j;
-                        break;
-                    }
+        // Recursive descent over the grammar below, i is the index of the next character of s to read
+        //   union  := concat ('+' concat)*
+        //   concat := repeat ('.' repeat)*
+        //   repeat := atom ('*' | '?' | '{m,n}')*
+        //   atom   := '(' union ')' | byte | escape | class | null character
+
+        /// @brief Checks that the tree parsed up to s[i] stays within MAX_EXPANDED operands and MAX_CLOSURES
+        /// Bounds multiply across nested repetitions, so each one is checked as soon as it is read, before the
+        /// automaton builders would run out of memory unrolling it.
+        static void check_expanded(const RegexPtr &node, size_t i){
+            if(node->expanded > MAX_EXPANDED){
+                syntax_error("Regular expression expands to more than " + std::to_string(MAX_EXPANDED)
+                             + " operands at", i);
+            }
+            if(node->closures > MAX_CLOSURES){
+                syntax_error("Regular expression needs epsilon closures over more than " + std::to_string(MAX_CLOSURES)
+                             + " states at", i);
+            }
+        }
+
+        /// @brief a{min,max} as the parser builds it, already flattened by simplify_repeat when simplifying so
+        /// that check_expanded sees (a?){n} as the a{0,n} the builders will get
+        RegexPtr repeat(const RegexPtr &child, int min, int max){
+            return simplify_regex ? simplify_repeat(child, min, max) : RegexNode::repeat(child, min, max);
+        }
+
+        RegexPtr parse_union(const std::string &s, size_t &i){
+            std::vector<RegexPtr> alternatives = {parse_concat(s, i)};
+            while(i < s.size() && s[i] == '+'){
+                i++;
+                alternatives.push_back(parse_concat(s, i));
+            }
+            RegexPtr node = RegexNode::join(RegexNode::UNION, alternatives);
+            check_expanded(node, i);
+            return node;
+        }
+
+        RegexPtr parse_concat(const std::string &s, size_t &i){
+            std::vector<RegexPtr> parts = {parse_repeat(s, i)};
+            while(i < s.size() && s[i] == '.'){
+                i++;
+                parts.push_back(parse_repeat(s, i));
+            }
+            RegexPtr node = RegexNode::join(RegexNode::CONCAT, parts);
+            check_expanded(node, i);
+            return node;
+        }
+
+        RegexPtr parse_repeat(const std::string &s, size_t &i){
+            RegexPtr node = parse_atom(s, i);
+            for(; i<s.size(); i++){
+                if(s[i] == '{'){
+                    size_t open = i;
+                    int min, max;
+                    read_repetition(s, i, min, max);
+                    node = repeat(node, min, max);
+                    check_expanded(node, open);
                 }
-                for(int j = 0; j<2; j++){
-                    if(s[i] == biops[j]){
-                        isBiops = true;
-                        break;
-                    }
+                else if(s[i] == '*'){
+                    node = repeat(node, 0, -1);
                 }
-                for(int j = 0; j<1; j++){
-                    if(s[i] == unops[j]){
-                        isUnops = true;
-                        break;
-                    }
+                else if(s[i] == '?'){
+                    node = repeat(node, 0, 1);
+                    check_expanded(node, i);
+                }
+                else{
+                    break;
+                }
+            }
+            return node;
+        }
+
+        RegexPtr parse_atom(const std::string &s, size_t &i){
+            if(i >= s.size() || std::string("+.*?{)").find(s[i]) != std::string::npos){
+                syntax_error("Missing operand before", i);
+            }
+            if(s[i] == ']' || s[i] == '}'){
+                syntax_error("Bracket mis-match at", i);
+            }
+            RegexPtr node;
+            if(s[i] == '('){
+                size_t open = i++;
+                node = parse_union(s, i);
+                if(i >= s.size()) syntax_error("Bracket mis-match at", open);
+                if(s[i] != ')') unexpected_after_operand(s, i);
+            }
+            else if(s[i] == nullchar){
+                node = RegexNode::empty();
+            }
+            else if(s[i] == '\\'){
+                node = read_escape(s, i);
+            }
+            else if(s[i] == '['){
+                node = read_class(s, i);
+            }
+            else{
+                if(!in_alphabet(s[i], s[i])){
+                    std::string err = "FACompiler does not have the alphabet provided in regular expression";
+                    throw err;
+                }
+                node = RegexNode::bytes({{(unsigned char)s[i], (unsigned char)s[i]}});
+            }
+            i++;
+            return node;
+        }
+
+        /// @brief Checks the regex and parses it into a syntax tree
+        /// '*', '?' and repetitions bind tighter than '.', which binds tighter than '+'. Every literal is checked
+        /// against the alphabet as it is read.
+        RegexPtr parse(const std::string &s){
+            size_t i = 0;
+            RegexPtr tree = parse_union(s, i);
+            if(i < s.size()){
+                unexpected_after_operand(s, i);
+            }
+            return tree;
+        }
+
+        /// @brief a{min,max} with the directly nested repetitions (a*)*, (a*)?, (a?)*, (a+)*, (a+)+ and (a{0,j}){k,l}
+        /// flattened
+        static RegexPtr simplify_repeat(RegexPtr child, int min, int max){
+            while(child->kind == RegexNode::REPEAT && child->max != 0 && max != 0){
+                if(child->max == -1 || max == -1){
+                    // (a{i,j}){k,l} matches every count of a from i*k up when i is 0, or both i and k are at most 1
+                    if(!(child->min == 0 || (child->min <= 1 && min <= 1))) break;
+                    min = child->min*min;
+                    max = -1;
+                }
+                else{
+                    // (a{0,j}){k,l} matches every count of a up to j*l, (a?){n} is a{0,n}. Any copy may be empty,
+                    // and a copy of a that cannot be empty keeps each epsilon closure small
+                    if(child->min != 0) break;
+                    min = 0;
+                    max = child->max*max;
+                }
+                child = child->children[0];
+            }
+            if(child->kind == RegexNode::EMPTY || max == 0) return RegexNode::empty();
+            if(min == 1 && max == 1) return child;
+            return RegexNode::repeat(child, min, max);
+        }
+
+        /// @brief Concatenation of simplified parts, nested concatenations flattened and empty strings dropped
+        static RegexPtr simplify_concat(const std::vector<RegexPtr> &parts){
+            std::vector<RegexPtr> flat;
+            for(auto& part: parts){
+                if(part->kind == RegexNode::CONCAT){
+                    flat.insert(flat.end(), part->children.begin(), part->children.end());
+                }
+                else if(part->kind != RegexNode::EMPTY){
+                    flat.push_back(part);
                 }
+            }
+            return flat.empty() ? RegexNode::empty() : RegexNode::join(RegexNode::CONCAT, flat);
+        }
 
-                if(isBracket){
-                    if(bidx%2 == 0){
-                        operators.push(s[i]);
+        /// @brief Factors the alternatives sharing their first element (prefix) or else their last one
+        /// a.b+a.c becomes a.(b+c) and a.c+b.c becomes (a+b).c, the union of what is left is simplified again.
+        /// A group takes the place of its first alternative.
+        static std::vector<RegexPtr> factor_alternatives(const std::vector<RegexPtr> &alternatives, bool prefix){
+            auto elements = [](const RegexPtr &node) -> std::vector<RegexPtr> {
+                if(node->kind == RegexNode::CONCAT) return node->children;
+                if(node->kind == RegexNode::EMPTY) return {};
+                return {node};
+            };
+            std::vector<RegexPtr> result;
+            std::vector<bool> grouped(alternatives.size(), false);
+            for(int i = 0; i<(int)alternatives.size(); i++){
+                if(grouped[i]) continue;
+                std::vector<RegexPtr> sequence = elements(alternatives[i]);
+                if(sequence.empty()){
+                    result.push_back(alternatives[i]);
+                    continue;
+                }
+                RegexPtr shared = prefix ? sequence.front() : sequence.back();
+                std::vector<int> group;
+                std::vector<RegexPtr> rests;
+                for(int j = i; j<(int)alternatives.size(); j++){
+                    std::vector<RegexPtr> other = elements(alternatives[j]);
+                    if(grouped[j] || other.empty() || !(prefix ? other.front() : other.back())->same(*shared)) continue;
+                    group.push_back(j);
+                    if(prefix){
+                        other.erase(other.begin());
                     }
                     else{
-                        while(!operators.empty()){
-                            char t = operators.top(); operators.pop();
-                            if(t == brackets[bidx-1]) break;
-                            ans.push_back(t);
+                        other.pop_back();
+                    }
+                    rests.push_back(simplify_concat(other));
+                }
+                if(group.size() == 1){
+                    result.push_back(alternatives[i]);
+                    continue;
+                }
+                for(auto& j: group){
+                    grouped[j] = true;
+                }
+                RegexPtr rest = simplify_union(rests);
+                result.push_back(prefix ? simplify_concat({shared, rest}) : simplify_concat({rest, shared}));
+            }
+            return result;
+        }
+
+        /// @brief Union of simplified alternatives
+        /// Nested unions are flattened, the byte classes merged into one, duplicates dropped and common prefixes
+        /// and suffixes factored. An empty alternative makes the union optional instead.
+        static RegexPtr simplify_union(const std::vector<RegexPtr> &alternatives){
+            std::vector<RegexPtr> flat;
+            for(auto& alternative: alternatives){
+                if(alternative->kind == RegexNode::UNION){
+                    flat.insert(flat.end(), alternative->children.begin(), alternative->children.end());
+                }
+                else{
+                    flat.push_back(alternative);
+                }
+            }
+
+            std::vector<RegexPtr> unique;
+            bool member[256] = {false};
+            int bytes_at = -1;
+            bool nullable = false;
+            for(auto& alternative: flat){
+                if(alternative->kind == RegexNode::EMPTY){
+                    nullable = true;
+                    continue;
+                }
+                if(alternative->kind == RegexNode::BYTES){
+                    for(auto& range: alternative->ranges){
+                        for(int c = range.first; c<=range.second; c++){
+                            member[c] = true;
                         }
                     }
+                    if(bytes_at == -1){
+                        bytes_at = unique.size();
+                        unique.push_back(alternative);
+                    }
+                    continue;
                 }
+                bool duplicate = false;
+                for(auto& kept: unique){
+                    duplicate = duplicate || kept->same(*alternative);
+                }
+                if(!duplicate) unique.push_back(alternative);
+            }
+            if(bytes_at != -1){
+                unique[bytes_at] = RegexNode::bytes(member_ranges(member));
+            }
+            if(unique.empty()) return RegexNode::empty();
+
+            if(unique.size() > 1){
+                unique = factor_alternatives(unique, true);
+            }
+            if(unique.size() > 1){
+                unique = factor_alternatives(unique, false);
+            }
+            RegexPtr result = RegexNode::join(RegexNode::UNION, unique);
+            return nullable ? simplify_repeat(result, 0, 1) : result;
+        }
+
+        /// @brief Rewrites a tree into an equivalent one with fewer nodes, see simplify_repeat, simplify_concat and
+        /// simplify_union
+        static RegexPtr simplify(const RegexPtr &node){
+            std::vector<RegexPtr> children;
+            for(auto& child: node->children){
+                children.push_back(simplify(child));
+            }
+            if(node->kind == RegexNode::REPEAT) return simplify_repeat(children[0], node->min, node->max);
+            if(node->kind == RegexNode::CONCAT) return simplify_concat(children);
+            if(node->kind == RegexNode::UNION) return simplify_union(children);
+            return node;
+        }
+
+        /// @brief Fuses the runs of single bytes in concatenations into literal strings
+        static RegexPtr fuse_literals(const RegexPtr &node){
+            std::vector<RegexPtr> children;
+            for(auto& child: node->children){
+                children.push_back(fuse_literals(child));
+            }
+            if(node->kind == RegexNode::REPEAT) return RegexNode::repeat(children[0], node->min, node->max);
+            if(node->kind == RegexNode::UNION) return RegexNode::join(RegexNode::UNION, children);
+            if(node->kind != RegexNode::CONCAT) return node;
 
-                else if(isBiops){
-                    operators.push(s[i]);
+            std::vector<RegexPtr> parts;
+            for(int k = 0; k<(int)children.size(); ){
+                std::string literal;
+                for(; k<(int)children.size() && children[k]->single_byte(); k++){
+                    literal.push_back(children[k]->ranges[0].first);
                 }
+                if(literal.size() == 1){
+                    parts.push_back(children[k - 1]);
+                }
+                else if(!literal.empty()){
+                    parts.push_back(RegexNode::string(literal));
+                }
+                else{
+                    parts.push_back(children[k++]);
+                }
+            }
+            return RegexNode::join(RegexNode::CONCAT, parts);
+        }
 
-                else if(isUnops){
-                    ans.push_back(s[i]);
+        /// @brief Appends the postfix form of a tree, n-ary unions and concatenations are written left to right
+        void write_postfix(const RegexPtr &node, std::string &out){
+            if(node->kind == RegexNode::EMPTY){
+                out.push_back(nullchar);
+            }
+            else if(node->kind == RegexNode::BYTES){
+                write_postfix_class(out, node->ranges, nullchar);
+            }
+            else if(node->kind == RegexNode::LITERAL){
+                write_postfix_literal(out, node->literal, nullchar);
+            }
+            else if(node->kind == RegexNode::REPEAT){
+                write_postfix(node->children[0], out);
+                if(node->min == 0 && node->max == -1){
+                    out.push_back('*');
+                }
+                else if(node->min == 0 && node->max == 1){
+                    out.push_back('?');
                 }
                 else{
-                    ans.push_back(s[i]);
+                    out += "{" + std::to_string(node->min) + "," + (node->max == -1 ? "" : std::to_string(node->max)) + "}";
+                }
+            }
+            else{
+                for(int k = 0; k<(int)node->children.size(); k++){
+                    write_postfix(node->children[k], out);
+                    if(k > 0) out.push_back(node->kind == RegexNode::UNION ? '+' : '.');
                 }
             }
+        }
 
-            while(!operators.empty()){
-                char t = operators.top(); operators.pop();
-                ans.push_back(t);
+        /// @brief Checks the regex and converts it to the postfix form compiled into an FA
+        /// The FA is built from the postfix form of the simplified syntax tree, unless simplification is disabled.
+        std::string prepare(const std::string &s){
+            RegexPtr tree = parse(s);
+            if(simplify_regex){
+                tree = fuse_literals(simplify(tree));
             }
+            std::string postfix;
+            write_postfix(tree, postfix);
+            return postfix;
+        }
 
-            return ans;
+        /// @brief Cache key of a postfix regex compiled with the current alphabet, null character and options
+        std::string cache_key(const std::string &postfix){
+            std::string key;
+            key += std::to_string(postfix.size()) + ":" + postfix;
+            key += std::to_string(alphabet.size()) + ":" + alphabet;
+            key.push_back(nullchar);
+            key += std::to_string((int)options.mode) + ":" + std::to_string((int)options.construction) + ":"
+                   + std::to_string(options.minimize) + ":"
+                   + std::to_string(options.search) + ":" + std::to_string(options.lazy_cache_bytes);
+            return key;
         }
     
     public:
+        // Largest bound of a {m,n} repetition
+        static const int MAX_REPEAT = 1000;
+        // Most operands a regex may unroll to, (a{100}){100} is the limit. Nested bounds multiply, and
+        // (a{300}){300} already takes seconds and gigabytes to compile
+        static const size_t MAX_EXPANDED = 10000;
+        // Largest estimate of the summed epsilon closure sizes, see RegexNode::closures. (a?.b?){300} is below
+        // it, ((a?){100}){100} flattens to a{0,10000} and passes, (a?.b?){1000} does not
+        static const size_t MAX_CLOSURES = 200000;
+
         FACompiler(const std::string &s){
             if(s.size() > 1){
                 this->nullchar = s[0];
                 this->alphabet = s.substr(1);
                 std::sort(this->alphabet.begin(), this->alphabet.end());
-                std::cout << "Null character is: " << this->nullchar << std::endl;
-                std::cout << "Alphabet allowed: " << this->alphabet << std::endl;
             }
             else{
                 std::string err = "FACompiler ctor accepts string of atleast 2, first character is null character\n";
                 throw err;
             }
+            if(nullchar != '\0' && strchr("(){}[].+*?\"\\", nullchar) != nullptr){
+                std::string err = "Null character of FACompiler can not be an operator, a bracket, a quote or a backslash\n";
+                throw err;
+            }
         }
 
-        FA compile(const std::string &s){
+        /// @brief Compiler over every byte 0-255, for binary or UTF-8 input
+        /// The null character still stands for the empty string, its byte is written \xHH like any other.
+        FACompiler(char nullchar): FACompiler(std::string(1, nullchar) + all_bytes()){
+        }
 
-            bool check_balance = check_bracket_balance(s);
-            if(!check_balance){
-                std::string err = "Bracket mis-match in regular expression provided";
-                throw err;
+        /// @brief The 256 byte values in increasing order
+        static std::string all_bytes(){
+            std::string bytes(256, '\0');
+            for(int c = 0; c<256; c++){
+                bytes[c] = (char)c;
             }
+            return bytes;
+        }
 
-            bool check_alphabet = contains_alphabet(s);
-            if(!check_alphabet){
-                std::string err = "FACompiler does not have the alphabet provided in regular expression";
-                throw err;
+        char get_nullchar() const{
+            return nullchar;
+        }
+
+        /// @brief Allowed alphabet, sorted
+        const std::string& get_alphabet() const{
+            return alphabet;
+        }
+
+        FA compile(const std::string &s){
+            auto begin = std::chrono::steady_clock::now();
+            std::string postfix = prepare(s);
+            double postfix_seconds = seconds_since(begin);
+
+            FA fa(postfix, this->alphabet, nullchar, options);
+            fa.statistics.postfix_seconds = postfix_seconds;
+            return fa;
+        }
+
+        /// @brief Compiles a set of regexes into one FA, FA::matches reports which of them accept a string
+        FA compile_set(const std::vector<std::string> &regexes){
+            auto begin = std::chrono::steady_clock::now();
+            std::vector<std::string> postfixes;
+            for(auto& s: regexes){
+                postfixes.push_back(prepare(s));
             }
+            double postfix_seconds = seconds_since(begin);
+
+            FA fa(postfixes, this->alphabet, nullchar, options);
+            fa.statistics.postfix_seconds = postfix_seconds;
+            return fa;
+        }
+
+        /// @brief Like compile(), but returns a shared handle from the compile cache of this FACompiler
+        /// Regexes with the same postfix form, compiled with the same options, share one FA. Thread-safe.
+        std::shared_ptr<const FA> compile_shared(const std::string &s){
+            auto begin = std::chrono::steady_clock::now();
+            std::string postfix = prepare(s);
+            double postfix_seconds = seconds_since(begin);
+
+            FAOptions options = this->options;
+            return cache.get(cache_key(postfix), [&](){
+                FA fa(postfix, this->alphabet, this->nullchar, options);
+                fa.statistics.postfix_seconds = postfix_seconds;
+                return fa;
+            });
+        }
+
+        /// @brief Maximum number of FAs kept by compile_shared() (64 by default), 0 disables the cache
+        void set_cache_size(size_t entries){
+            cache.set_capacity(entries);
+        }
+
+        size_t cache_hits(){
+            return cache.hit_count();
+        }
+
+        size_t cache_misses(){
+            return cache.miss_count();
+        }
+
+        /// @brief Enable or disable Hopcroft minimization of compiled DFAs (enabled by default)
+        void set_minimize(bool minimize){
+            this->options.minimize = minimize;
+        }
+
+        /// @brief Enable or disable the rewriting of parsed regexes into smaller equivalent ones (enabled by default)
+        void set_simplify(bool simplify){
+            this->simplify_regex = simplify;
+        }
+
+        /// @brief Select the matching engine of compiled FAs (eager DFA by default)
+        void set_mode(FAMode mode){
+            this->options.mode = mode;
+        }
+
+        /// @brief Select how the NFA is built from the regex (Thompson's rules by default)
+        void set_construction(FAConstruction construction){
+            this->options.construction = construction;
+        }
+
+        /// @brief Also build the reverse and unanchored DFAs needed by FA::search (disabled by default)
+        void set_search(bool search){
+            this->options.search = search;
+        }
+
+        /// @brief Runs the subset construction of later compilations across pool, nullptr (the default) runs it on the
+        /// compiling thread. States are numbered the same way in both cases, so the DFA does not depend on it.
+        void set_compile_pool(ThreadPool *pool){
+            this->options.compile_pool = pool;
+        }
+
+        /// @brief Memory budget in bytes of the state cache used by FAMode::LAZY_DFA
+        void set_lazy_cache_size(size_t bytes){
+            this->options.lazy_cache_bytes = bytes;
+        }
+};
+
+const int FACompiler::MAX_REPEAT;
+const size_t FACompiler::MAX_EXPANDED;
+const size_t FACompiler::MAX_CLOSURES;
+
+/// @brief Random input over alphabet, the same for a given seed
+std::string bench_input(const std::string &alphabet, size_t len, uint64_t seed){
+    std::string s(len, '\0');
+    for(size_t i = 0; i<len; i++){
+        // xorshift64
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        s[i] = alphabet[seed % alphabet.size()];
+    }
+    return s;
+}
+
+/// @brief sample repeated up to len bytes, the last copy cut short
+std::string bench_repeat(const std::string &sample, size_t len){
+    std::string s;
+    s.reserve(len);
+    while(s.size() < len){
+        s.append(sample, 0, std::min(sample.size(), len - s.size()));
+    }
+    return s;
+}
+
+/// @brief Throughput in MB/s of f over input, repeated for at least min_seconds
+/// The results of f are summed into a volatile so that the calls cannot be optimized away.
+template<typename F>
+double bench_throughput(const std::string &input, double min_seconds, F f){
+    volatile size_t sink = 0;
+    size_t bytes = 0;
+    int rounds = 0;
+    auto begin = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while(elapsed < min_seconds || rounds == 0){
+        sink = sink + f(input);
+        bytes += input.size();
+        rounds++;
+        elapsed = seconds_since(begin);
+    }
+    return bytes/elapsed/1e6;
+}
+
+/// @brief Runs the benchmark corpus and prints one JSON object per line on stdout
+/// Every pattern reports its compile phases ("bench":"compile") and then the check and trace_states throughput
+/// over inputs of several lengths ("bench":"check", "bench":"trace"). The (a+b)*.a.(a+b)^n patterns have a
+/// DFA of 2^(n+1) states and are measured with the engines that avoid building it as well, and with the subset
+/// construction spread over ThreadPool::shared().
+/// Every input is read to its end: matching stops at the dead state, which random bytes reach within a few bytes
+/// of a pattern that does not start with (a+b)*. Such patterns are repeated, and measured over copies of a string
+/// they match instead.
+void run_benchmarks(){
+    struct BenchCase{
+        std::string name;
+        std::string regex;
+        FAMode mode;
+        FAConstruction construction;
+        // Subset construction on ThreadPool::shared()
+        bool parallel;
+        // Inputs are copies of it, random bytes when empty
+        std::string sample;
+    };
+    std::string pairs;
+    for(int i = 0; i<200; i++){
+        pairs += "ab";
+    }
+    std::vector<BenchCase> corpus = {
+        {"literal", "(a.b.b.a.b.a.a.b){1,}", FAMode::DFA, FAConstruction::THOMPSON, false, "abbabaab"},
+        {"any", "((a+b)*)", FAMode::DFA, FAConstruction::THOMPSON, false, ""},
+        {"suffix", "((a+b)*.a.b.b)", FAMode::DFA, FAConstruction::THOMPSON, false, ""},
+        {"nested_star", "(((a.b)*+(b.a.a)*)*.b)", FAMode::DFA, FAConstruction::THOMPSON, false, "abbaa"},
+        {"repeat", "(([ab].b){1,200}.a.a)*", FAMode::DFA, FAConstruction::THOMPSON, false, pairs + "aa"},
+    };
+    for(int n: {4, 8, 12, 16}){
+        std::string regex = "((a+b)*.a";
+        for(int i = 0; i<n; i++){
+            regex += ".(a+b)";
+        }
+        regex += ")";
+        corpus.push_back({"blowup_" + std::to_string(n), regex, FAMode::DFA, FAConstruction::THOMPSON, false, ""});
+        if(n == 16){
+            corpus.push_back({"blowup_" + std::to_string(n), regex, FAMode::LAZY_DFA, FAConstruction::THOMPSON, false, ""});
+            corpus.push_back({"blowup_" + std::to_string(n), regex, FAMode::NFA, FAConstruction::THOMPSON, false, ""});
+            corpus.push_back({"blowup_" + std::to_string(n), regex, FAMode::DFA, FAConstruction::THOMPSON, true, ""});
+            corpus.push_back({"blowup_" + std::to_string(n), regex, FAMode::DFA, FAConstruction::GLUSHKOV, false, ""});
+            corpus.push_back({"blowup_" + std::to_string(n), regex, FAMode::NFA, FAConstruction::GLUSHKOV, false, ""});
+        }
+    }
+    const char *mode_names[] = {"dfa", "lazy_dfa", "nfa"};
+    const char *construction_names[] = {"thompson", "glushkov"};
+    const double MIN_SECONDS = 0.2;
+
+    for(auto& bench: corpus){
+        const char *mode = mode_names[(int)bench.mode];
+        const char *construction = construction_names[(int)bench.construction];
+
+        FACompiler compiler("0ab");
+        compiler.set_mode(bench.mode);
+        compiler.set_construction(bench.construction);
+        compiler.set_compile_pool(bench.parallel ? &ThreadPool::shared() : nullptr);
+        FA fa = compiler.compile(bench.regex);
+        int threads = bench.parallel ? ThreadPool::shared().size() : 1;
 
-            std::string postfix = infix_postfix(s);
+        const FAStats &stats = fa.stats();
+        std::cout << "{\"bench\":\"compile\",\"name\":\"" << bench.name << "\",\"regex\":\"" << bench.regex
+                  << "\",\"mode\":\"" << mode << "\",\"construction\":\"" << construction
+                  << "\",\"threads\":" << threads << ",\"postfix_s\":" << stats.postfix_seconds
+                  << ",\"nfa_s\":" << stats.nfa_seconds << ",\"index_s\":" << stats.index_seconds
+                  << ",\"dfa_s\":" << stats.dfa_seconds << ",\"minimize_s\":" << stats.minimize_seconds
+                  << ",\"nfa_bytes\":" << stats.nfa_bytes << ",\"index_bytes\":" << stats.index_bytes
+                  << ",\"dfa_bytes\":" << stats.dfa_bytes << ",\"minimize_bytes\":" << stats.minimize_bytes
+                  << ",\"nfa_states\":" << stats.nfa_states << ",\"byte_classes\":" << stats.byte_classes
+                  << ",\"dfa_states\":" << stats.dfa_states
+                  << ",\"min_dfa_states\":" << stats.min_dfa_states << ",\"closures\":" << stats.closures
+                  << ",\"closure_merges\":" << stats.closure_merges << ",\"subsets\":" << stats.subsets
+                  << ",\"subset_table_bytes\":" << stats.subset_table_bytes << "}" << std::endl;
+
+        for(size_t len: {(size_t)64, (size_t)4096, (size_t)1 << 20}){
+            std::string input = bench.sample.empty() ? bench_input("ab", len, 0x9e3779b97f4a7c15ULL + len)
+                                                     : bench_repeat(bench.sample, len);
+            double check_rate = bench_throughput(input, MIN_SECONDS, [&](const std::string &s){
+                return (size_t)fa.check(s);
+            });
+            std::cout << "{\"bench\":\"check\",\"name\":\"" << bench.name << "\",\"mode\":\"" << mode
+                      << "\",\"construction\":\"" << construction << "\",\"length\":" << len << ",\"mb_per_s\":" << check_rate << "}" << std::endl;
+
+            if(bench.mode == FAMode::NFA) continue;
+            double trace_rate = bench_throughput(input, MIN_SECONDS, [&](const std::string &s){
+                return fa.trace_states(s).size();
+            });
+            std::cout << "{\"bench\":\"trace\",\"name\":\"" << bench.name << "\",\"mode\":\"" << mode
+                      << "\",\"construction\":\"" << construction << "\",\"length\":" << len << ",\"mb_per_s\":" << trace_rate << "}" << std::endl;
+        }
+    }
+}
 
-            std::cout << "For input " << s << " postfix notation is: " << postfix << std::endl;
+/// @brief Failure count of run_tests
+struct TestLog{
+    int failures = 0;
 
-            return FA(postfix, this->alphabet, nullchar);
+    /// @brief Prints what and counts a failure unless ok
+    void expect(bool ok, const std::string &what){
+        if(!ok){
+            std::cout << "FAIL " << what << std::endl;
+            failures++;
         }
+    }
 };
 
-int main(){
+/// @brief Every string over letters of at most max_length bytes, shortest first
+std::vector<std::string> all_strings(const std::string &letters, int max_length){
+    std::vector<std::string> result = {""};
+    for(size_t i = 0; i<result.size(); i++){
+        if((int)result[i].size() == max_length) continue;
+        for(auto& c: letters){
+            result.push_back(result[i] + c);
+        }
+    }
+    return result;
+}
+
+/// @brief Message of the std::string thrown compiling regex over "0ab", empty when it compiles
+std::string compile_error(const std::string &regex){
+    try{
+        FACompiler compiler("0ab");
+        compiler.compile(regex);
+    }
+    catch(std::string err){
+        return err;
+    }
+    return std::string();
+}
+
+/// @brief Source of one string literal holding s, every byte written as an octal escape
+std::string cpp_literal(const std::string &s){
+    std::string literal = "std::string(\"";
+    for(auto& c: s){
+        unsigned char b = c;
+        literal += "\\" + std::to_string(b >> 6) + std::to_string((b >> 3) & 7) + std::to_string(b & 7);
+    }
+    return literal + "\", " + std::to_string(s.size()) + ")";
+}
+
+/// @brief New empty directory for the files written by run_tests, empty when files cannot be written
+std::string test_directory(){
+#ifdef _WIN32
+    return "";
+#else
+    char path[] = "/tmp/regex_automata_test_XXXXXX";
+    return mkdtemp(path) ? path : "";
+#endif
+}
+
+/// @brief Limits on what a regex may expand to, see FACompiler::MAX_EXPANDED and FACompiler::MAX_CLOSURES
+void test_repetition_limits(TestLog &log){
+    // Nested bounds multiply, these would unroll to 10^4 to 10^6 operands
+    for(std::string regex: {"(a{300}){300}", "((a{100}){100}){100}", "(a.b){1000}.(a{1000}){9}"}){
+        std::string err = compile_error(regex);
+        log.expect(err.find("position") != std::string::npos, "nested repetition " + regex + " is rejected: " + err);
+    }
+    log.expect(compile_error("(a{100}){100}").empty(), "(a{100}){100} compiles");
+
+    // Repeated optional operands flatten into a{0,n}, whose closures stay small in both constructions
+    std::vector<std::pair<std::string, size_t>> optional_repeats = {
+        {"(a?){1000}", 1000}, {"(a{0,100}){100}", 10000}, {"((a?){50}){40}", 2000}, {"((a?){100}){100}", 10000}
+    };
+    for(auto& test: optional_repeats){
+        for(FAConstruction construction: {FAConstruction::THOMPSON, FAConstruction::GLUSHKOV}){
+            FACompiler compiler("0ab");
+            compiler.set_construction(construction);
+            auto begin = std::chrono::steady_clock::now();
+            FA fa = compiler.compile(test.first);
+            double elapsed = seconds_since(begin);
+            std::string what = test.first + " construction " + std::to_string((int)construction);
+            log.expect(elapsed < 2, what + " compiles quickly, took " + std::to_string(elapsed) + " s");
+            log.expect(fa.check("") && fa.check(std::string(test.second, 'a')) && !fa.check(std::string(test.second + 1, 'a')),
+                       what + " matches up to " + std::to_string(test.second) + " a");
+        }
+    }
+    std::string closure_error = compile_error("(a?.b?){1000}");
+    log.expect(closure_error.find("closures") != std::string::npos && closure_error.find("position") != std::string::npos,
+               "repeated nullable operand (a?.b?){1000} is rejected: " + closure_error);
+}
+
+/// @brief Every matching engine, the saved and loaded DFA and the generated C++ agree on one corpus
+/// The DFA of the Thompson NFA is the reference. NFA mode runs the bit-parallel tables on NFAs of at most
+/// 256 states and the lazy DFA steps subsets one class at a time, so both matchers of the NFA are compared.
+/// The last pattern has more states than fit the bit-parallel tables.
+void test_engines(TestLog &log, const std::string &directory){
+    struct TestEngine{
+        std::string name;
+        FAMode mode;
+        FAConstruction construction;
+        bool minimize;
+        bool simplify;
+        size_t lazy_cache_bytes;
+    };
+    std::vector<TestEngine> engines = {
+        {"dfa", FAMode::DFA, FAConstruction::THOMPSON, true, true, 0},
+        {"dfa_unminimized", FAMode::DFA, FAConstruction::THOMPSON, false, true, 0},
+        {"dfa_unsimplified", FAMode::DFA, FAConstruction::THOMPSON, true, false, 0},
+        {"dfa_glushkov", FAMode::DFA, FAConstruction::GLUSHKOV, true, true, 0},
+        {"lazy", FAMode::LAZY_DFA, FAConstruction::THOMPSON, true, true, 8 << 20},
+        {"lazy_flushing", FAMode::LAZY_DFA, FAConstruction::THOMPSON, true, true, 1 << 11},
+        {"nfa", FAMode::NFA, FAConstruction::THOMPSON, true, true, 0},
+        {"nfa_glushkov", FAMode::NFA, FAConstruction::GLUSHKOV, true, true, 0},
+    };
+    std::vector<std::string> corpus = {
+        "a.b", "(a+b)*.a.b.b", "(a.b)*+(b.a)*", "a*.b*.a*", "((a.b)*+(b.a.a)*)*.b", "(a+b){2,4}", "a{3,}.b?",
+        "[ab].b{0,2}.a", "0", "(a+0).b", "(a?.b?){5}", "(a+b)*.a.(a+b).(a+b).(a+b)", "(a.a+b)*.(b.b)?",
+        "[^a]*.a", "(a+b){0,150}.b"
+    };
+    std::vector<std::string> inputs = all_strings("ab", 8);
+    for(std::string outside: {"c", "abc", "ba\x01"}){
+        inputs.push_back(outside);
+    }
+
+    // A few answers of the reference itself
+    FACompiler plain("0ab");
+    log.expect(plain.compile("(a+b)*.a.b.b").check("babb") && !plain.compile("(a+b)*.a.b.b").check("abba"),
+               "(a+b)*.a.b.b matches strings ending in abb");
+    log.expect(plain.compile("a{3,}.b?").check("aaab") && !plain.compile("a{3,}.b?").check("aab"), "a{3,}.b? needs 3 a");
+    log.expect(plain.compile("0").check("") && !plain.compile("0").check("a"), "0 matches the empty string alone");
+
+    std::vector<std::vector<bool>> expected;
+    for(auto& regex: corpus){
+        std::vector<bool> answers;
+        for(auto& engine: engines){
+            FACompiler compiler("0ab");
+            compiler.set_mode(engine.mode);
+            compiler.set_construction(engine.construction);
+            compiler.set_minimize(engine.minimize);
+            compiler.set_simplify(engine.simplify);
+            if(engine.mode == FAMode::LAZY_DFA){
+                compiler.set_lazy_cache_size(engine.lazy_cache_bytes);
+            }
+            FA fa = compiler.compile(regex);
+            for(size_t j = 0; j<inputs.size(); j++){
+                if(answers.size() < inputs.size()){
+                    answers.push_back(fa.check(inputs[j]));
+                }
+                else if(fa.check(inputs[j]) != answers[j]){
+                    log.expect(false, engine.name + " disagrees with dfa on " + regex + " for \"" + inputs[j] + "\"");
+                    break;
+                }
+            }
+        }
+        expected.push_back(answers);
+    }
+
+    if(directory.empty()){
+        std::cout << "SKIP saved DFAs and generated C++, no directory to write to" << std::endl;
+        return;
+    }
+    // The saved DFA is mapped back and verified, the generated matchers are compiled into one program
+    std::ofstream source(directory + "/generated.cpp");
+    for(size_t i = 0; i<corpus.size(); i++){
+        FACompiler compiler("0ab");
+        FA fa = compiler.compile(corpus[i]);
+        std::string path = directory + "/pattern" + std::to_string(i) + ".dfa";
+        fa.save(path);
+        FA loaded = FA::load(path);
+        for(size_t j = 0; j<inputs.size(); j++){
+            if(loaded.check(inputs[j]) != expected[i][j]){
+                log.expect(false, "loaded DFA disagrees with dfa on " + corpus[i] + " for \"" + inputs[j] + "\"");
+                break;
+            }
+        }
+        fa.generate_cpp(source, "pattern" + std::to_string(i));
+    }
+    source << "#include <string>" << std::endl;
+    source << "static const std::string inputs[] = {" << std::endl;
+    for(auto& input: inputs){
+        source << "    " << cpp_literal(input) << "," << std::endl;
+    }
+    source << "};" << std::endl;
+    source << "int main(){" << std::endl;
+    source << "    int failures = 0;" << std::endl;
+    for(size_t i = 0; i<corpus.size(); i++){
+        std::string answers;
+        for(bool answer: expected[i]){
+            answers += answer ? '1' : '0';
+        }
+        source << "    for(int j = 0; j<" << inputs.size() << "; j++){" << std::endl;
+        source << "        failures += pattern" << i << "(inputs[j]) != (\"" << answers << "\"[j] == '1');" << std::endl;
+        source << "    }" << std::endl;
+    }
+    source << "    return failures ? 1 : 0;" << std::endl;
+    source << "}" << std::endl;
+    source.close();
+    if(std::system("c++ --version > /dev/null 2>&1") != 0){
+        std::cout << "SKIP generated C++, no c++ compiler" << std::endl;
+        return;
+    }
+    std::string program = directory + "/generated";
+    log.expect(std::system(("c++ -std=c++11 -O0 -o " + program + " " + program + ".cpp").c_str()) == 0,
+               "generated C++ compiles");
+    log.expect(std::system(program.c_str()) == 0, "generated C++ matchers agree with dfa");
+}
+
+/// @brief Hopcroft minimization gives the smallest DFA and keeps the language
+void test_minimization(TestLog &log){
+    // The dead state is counted, so (a+b)*.a.b.b has 4 live states and (a+b)*.a.(a+b)^n has 2^(n+1)
+    std::vector<std::pair<std::string, int>> sizes = {
+        {"(a+b)*.a.b.b", 5}, {"(a+b)*", 2}, {"(a*.b*)*", 2}, {"(a+b)*.a.(a+b).(a+b).(a+b)", 17}, {"a.b+a.b.b*", 4}
+    };
+    for(auto& test: sizes){
+        FACompiler compiler("0ab");
+        FA fa = compiler.compile(test.first);
+        compiler.set_minimize(false);
+        FA full = compiler.compile(test.first);
+        log.expect(fa.stats().min_dfa_states == test.second, test.first + " minimizes to " + std::to_string(test.second)
+                   + " states, got " + std::to_string(fa.stats().min_dfa_states));
+        log.expect(full.stats().min_dfa_states >= fa.stats().min_dfa_states, test.first + " unminimized is not smaller");
+    }
+}
+
+/// @brief A saved DFA loads back, and a damaged file is rejected
+void test_save_load(TestLog &log, const std::string &directory){
+    if(directory.empty()) return;
+    FACompiler compiler("0ab");
+    FA fa = compiler.compile("(a+b)*.a.b.b");
+    std::string path = directory + "/saved.dfa";
+    fa.save(path);
+    std::string file;
+    {
+        std::ifstream in(path, std::ios::binary);
+        file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    FA loaded = FA::load(path);
+    log.expect(loaded.check("aabb") && !loaded.check("abba"), "loaded DFA matches like the saved one");
+
+    // One flipped byte in the header, in the table and at the end, then a truncated file
+    std::vector<std::string> damaged;
+    for(size_t at: {(size_t)0, file.size()/2, file.size() - 1}){
+        damaged.push_back(file);
+        damaged.back()[at] ^= 0x20;
+    }
+    damaged.push_back(file.substr(0, file.size() - 8));
+    for(size_t k = 0; k<damaged.size(); k++){
+        std::string bad = directory + "/damaged" + std::to_string(k) + ".dfa";
+        std::ofstream(bad, std::ios::binary) << damaged[k];
+        bool rejected = false;
+        try{
+            FA::load(bad);
+        }
+        catch(std::string err){
+            rejected = true;
+        }
+        log.expect(rejected, "damaged DFA file " + std::to_string(k) + " is rejected");
+    }
+
+    compiler.set_mode(FAMode::NFA);
+    bool rejected = false;
+    try{
+        compiler.compile("a").save(directory + "/nfa.dfa");
+    }
+    catch(std::string err){
+        rejected = true;
+    }
+    log.expect(rejected, "an NFA mode FA cannot be saved");
+}
+
+/// @brief Product and complement accept what the operands say they should
+void test_set_operations(TestLog &log){
+    FACompiler compiler("0ab");
+    FA a = compiler.compile("(a+b)*.a.(a+b)");
+    FA b = compiler.compile("(a+b)*.b.b.(a+b)*");
+    FA both = FA::product(a, b, FASetOp::INTERSECTION);
+    FA either = FA::product(a, b, FASetOp::UNION);
+    FA only_a = FA::product(a, b, FASetOp::DIFFERENCE, false);
+    FA not_a = FA::complement(a);
+    for(auto& s: all_strings("ab", 8)){
+        bool in_a = a.check(s), in_b = b.check(s);
+        if(both.check(s) != (in_a && in_b) || either.check(s) != (in_a || in_b) || only_a.check(s) != (in_a && !in_b)
+           || not_a.check(s) == in_a){
+            log.expect(false, "set operations disagree with their operands on \"" + s + "\"");
+            break;
+        }
+    }
+    log.expect(!not_a.check("c") && !not_a.check("abc"), "complement rejects bytes outside the alphabet");
+
+    // Operands without a table get one built over their own alphabet, and are left as they were
+    for(FAMode mode: {FAMode::LAZY_DFA, FAMode::NFA}){
+        std::string name = "mode " + std::to_string((int)mode);
+        FACompiler ab("0ab"), bc("0bc");
+        ab.set_mode(mode);
+        bc.set_mode(mode);
+        FA x = ab.compile("a*.b");
+        FA y = bc.compile("b.c*");
+        size_t x_bytes = x.memory_bytes(), y_bytes = y.memory_bytes();
+        long long x_subsets = x.stats().subsets, y_subsets = y.stats().subsets;
+        FA either = FA::product(x, y, FASetOp::UNION);
+        FA both = FA::product(x, y, FASetOp::INTERSECTION);
+        FA not_x = FA::complement(x);
+        log.expect(either.check("aab") && either.check("bcc") && !either.check("abc") && !either.check("c"),
+                   name + " union of operands over different alphabets");
+        log.expect(both.check("b") && !both.check("ab") && !both.check("bc"), name + " intersection over the shared alphabet");
+        log.expect(not_x.check("ba") && !not_x.check("ab") && !not_x.check("c"), name + " complement");
+        log.expect(x.memory_bytes() == x_bytes && y.memory_bytes() == y_bytes && x.stats().subsets == x_subsets
+                   && y.stats().subsets == y_subsets, name + " operands are unchanged by the product");
+        log.expect(x.check("aab") && !x.check("c") && y.check("bcc") && !y.check("a"), name + " operands still match");
+    }
+}
+
+/// @brief \xHH escapes and \u{...} code point ranges encoded in UTF-8
+void test_escapes(TestLog &log){
+    FACompiler compiler('0');
+    std::vector<std::tuple<std::string, std::string, bool>> cases = {
+        {"\\x61.\\x62", "ab", true}, {"\\x61.\\x62", "a", false}, {"\\+.\\(", "+(", true},
+        {"\\u{3b1-3c9}", "\xce\xb1", true}, {"\\u{3b1-3c9}", "\xcf\x89", true}, {"\\u{3b1-3c9}", "\xcf\x8a", false},
+        {"\\u{3b1-3c9}", "a", false}, {"\\u{3b1-3c9}", "\xce\xb1\xce\xb1", false},
+        {"\\u{80-7ff}", "\xc2\x80", true}, {"\\u{80-7ff}", "\xdf\xbf", true}, {"\\u{80-7ff}", "\x7f", false},
+        {"\\u{80-7ff}", "\xe0\xa0\x80", false},
+        {"\\u{800-ffff}", "\xe0\xa0\x80", true}, {"\\u{800-ffff}", "\xef\xbf\xbf", true},
+        {"\\u{800-ffff}", "\xe0\x80\x80", false}, {"\\u{800-ffff}", "\xc2\x80", false},
+        {"\\u{10000-10ffff}", "\xf0\x90\x80\x80", true}, {"\\u{10000-10ffff}", "\xf4\x8f\xbf\xbf", true},
+        {"\\u{10000-10ffff}", "\xf4\x90\x80\x80", false}, {"\\u{10000-10ffff}", "\xf0\x8f\xbf\xbf", false},
+    };
+    for(auto& test: cases){
+        FA fa = compiler.compile(std::get<0>(test));
+        log.expect(fa.check(std::get<1>(test)) == std::get<2>(test), std::get<0>(test) + " on a "
+                   + std::to_string(std::get<1>(test).size()) + " byte input gives " + (std::get<2>(test) ? "false" : "true"));
+    }
+}
+
+/// @brief FAStream, check_batch and check_parallel agree with check()
+void test_bulk_matching(TestLog &log, const std::string &directory){
+    std::string text = bench_input("ab", 100000, 7) + "abb";
+    for(FAMode mode: {FAMode::DFA, FAMode::LAZY_DFA, FAMode::NFA}){
+        FACompiler compiler("0ab");
+        compiler.set_mode(mode);
+        FA fa = compiler.compile("(a+b)*.a.b.b");
+        std::string name = "mode " + std::to_string((int)mode);
+        for(size_t chunk: {(size_t)1, (size_t)7, (size_t)4096}){
+            FAStream stream(fa);
+            for(size_t i = 0; i<text.size(); i += chunk){
+                stream.feed(text.data() + i, std::min(chunk, text.size() - i));
+            }
+            log.expect(stream.finish(), name + " stream in chunks of " + std::to_string(chunk) + " accepts");
+            stream.feed("a", 1);
+            log.expect(!stream.finish(), name + " stream goes on after finish()");
+        }
+        if(!directory.empty()){
+            std::ofstream(directory + "/stream.txt", std::ios::binary) << text;
+            FAStream stream(fa);
+            stream.feed_file(directory + "/stream.txt");
+            log.expect(stream.finish(), name + " stream of a file accepts");
+        }
+
+        // Long enough strings for the interleaved DFA kernel, and more than one task
+        std::vector<std::string> strings;
+        std::string buffer;
+        std::vector<std::pair<size_t, size_t>> spans;
+        for(int i = 0; i<3000; i++){
+            strings.push_back(bench_input("ab", i%64, i) + (i%3 ? "abb" : ""));
+            spans.push_back({buffer.size(), strings.back().size()});
+            buffer += strings.back();
+        }
+        std::vector<uint64_t> bits = fa.check_batch(strings.data(), strings.size());
+        std::vector<uint64_t> span_bits = fa.check_batch(buffer.data(), spans.data(), spans.size());
+        for(size_t i = 0; i<strings.size(); i++){
+            bool accepted = fa.check(strings[i]);
+            if(((bits[i >> 6] >> (i & 63)) & 1) != accepted || ((span_bits[i >> 6] >> (i & 63)) & 1) != accepted){
+                log.expect(false, name + " check_batch disagrees with check on string " + std::to_string(i));
+                break;
+            }
+        }
+    }
+
+    // Chunks of at least 1 MiB are run from every state at once
+    ThreadPool pool(3);
+    FACompiler compiler("0ab");
+    FA fa = compiler.compile("(a+b)*.a.b.b");
+    std::string large = bench_input("ab", 5 << 20, 11) + "abb";
+    log.expect(fa.check_parallel(large, pool), "check_parallel accepts a large match");
+    large.back() = 'a';
+    log.expect(!fa.check_parallel(large, pool), "check_parallel rejects a large non-match");
+    large.back() = 'b';
+    large[3 << 20] = 'c';
+    log.expect(!fa.check_parallel(large, pool), "check_parallel rejects a byte outside the alphabet in a later chunk");
+}
+
+/// @brief compile_shared keeps the most recently used FAs and hands out FAs that outlive eviction
+void test_cache(TestLog &log){
+    FACompiler compiler("0ab");
+    compiler.set_cache_size(2);
+    std::shared_ptr<const FA> a = compiler.compile_shared("a");
+    compiler.compile_shared("b");
+    compiler.compile_shared("a.b");
+    log.expect(compiler.cache_hits() == 0 && compiler.cache_misses() == 3, "three regexes compile once each");
+    compiler.compile_shared("(b)");
+    log.expect(compiler.cache_hits() == 1, "a regex with the same postfix form is a hit");
+    compiler.compile_shared("a");
+    log.expect(compiler.cache_misses() == 4, "the least recently used regex was evicted");
+    log.expect(a->check("a") && !a->check("b"), "an evicted FA still matches");
+}
+
+/// @brief search() stays linear when every byte starts a match
+void test_search(TestLog &log){
+    // Every a is a match, and each one used to rescan the rest of the input looking for a c
+    FACompiler compiler("0abc");
+    compiler.set_search(true);
+    FA fa = compiler.compile("a+(a+b)*.c");
+    std::string text(1 << 16, 'a');
+    auto begin = std::chrono::steady_clock::now();
+    auto matches = fa.search(text);
+    double elapsed = seconds_since(begin);
+    log.expect(matches.size() == text.size() && matches.back() == std::make_pair(text.size() - 1, text.size()),
+               "search finds every a of a match-dense input");
+    log.expect(elapsed < 1, "search over a match-dense input is linear, took " + std::to_string(elapsed) + " s");
+    text += "c";
+    matches = fa.search(text);
+    log.expect(matches.size() == 1 && matches[0].second == text.size(), "search finds the longest match");
+
+    // Every match contains cab, found by memchr on one of its bytes wherever it is in the text
+    FA literal = compiler.compile("b*.c.a.b");
+    std::string near(1000, 'c');
+    for(size_t i = 0; i<near.size(); i += 3){
+        near[i] = 'a';
+    }
+    for(auto& test: std::vector<std::pair<std::string, size_t>>{{"cab", 1}, {near + "cab", 1}, {"cabb" + near, 1},
+                                                               {near, 0}, {"ca", 0}, {"cab" + near + "bbcab", 3}}){
+        log.expect(literal.search(test.first).size() == test.second, "search for b*.c.a.b in a " + std::to_string(test.first.size())
+                   + " byte text finds " + std::to_string(test.second) + " matches");
+    }
+}
+
+/// @brief The lazy DFA calls the visitor without holding its lock, so the visitor may match with the same FA
+void test_lazy_reentrancy(TestLog &log){
+    std::string regex = "(a+b)*.a";
+    for(int i = 0; i<10; i++){
+        regex += ".(a+b)";
+    }
+    FACompiler compiler("0ab");
+    compiler.set_mode(FAMode::LAZY_DFA);
+    compiler.set_lazy_cache_size(1 << 13);
+    FA fa = compiler.compile(regex);
+    std::string text;
+    for(int i = 0; i<4096; i++){
+        text += "ab"[(i*i + i/7)%2];
+    }
+    size_t visits = 0, nested = 0;
+    fa.trace(text.data(), text.size(), [&](uint32_t){
+        nested += fa.check(text.substr(0, visits));
+        visits++;
+    });
+    size_t expected = 0;
+    for(size_t i = 11; i<=text.size(); i++){
+        expected += text[i - 11] == 'a';
+    }
+    log.expect(visits == text.size() + 1 && nested == expected, "lazy DFA trace visitor can match with the same FA");
+}
+
+/// @brief A DFA keeps its table alone, the NFA and its bit-parallel tables are only kept to match in NFA mode
+void test_memory(TestLog &log){
+    FACompiler compiler("0ab");
+    FA dfa = compiler.compile("a.b");
+    compiler.set_mode(FAMode::NFA);
+    FA nfa = compiler.compile("a.b");
+    log.expect(dfa.memory_bytes() < 2048, "a.b DFA keeps " + std::to_string(dfa.memory_bytes()) + " bytes");
+    log.expect(nfa.check("ab") && !nfa.check("abb") && dfa.check("ab") && !dfa.check("a"), "a.b matches in DFA and NFA mode");
+}
+
+/// @brief Runs the regression checks and prints one line per failure
+/// Files are written to a fresh directory under /tmp, which is left behind for inspection.
+/// @return Number of failed checks
+int run_tests(){
+    TestLog log;
+    std::string directory = test_directory();
+    test_repetition_limits(log);
+    test_engines(log, directory);
+    test_minimization(log);
+    test_save_load(log, directory);
+    test_set_operations(log);
+    test_escapes(log);
+    test_bulk_matching(log, directory);
+    test_cache(log);
+    test_search(log);
+    test_lazy_reentrancy(log);
+    test_memory(log);
+
+    std::cout << (log.failures ? "FAILED" : "OK") << std::endl;
+    return log.failures;
+}
+
+int main(int argc, char **argv){
+    if(argc > 1 && std::string(argv[1]) == "--bench"){
+        run_benchmarks();
+        return 0;
+    }
+    if(argc > 1 && std::string(argv[1]) == "--test"){
+        return run_tests() ? 1 : 0;
+    }
+
     std::cout << "First character in string of FACompiler constructor is nullcharacter" << std::endl;
     std::cout << "+ symbol denotes OR. a+b means either a or b." << std::endl;
     std::cout << "* symbol denotes Kleene-Closure. a* means 0 or more instances of a." << std::endl;
     std::cout << ". symbol denotes concatenation. a.b means b comes after a." << std::endl;
+    std::cout << "? symbol denotes option. a? means 0 or 1 instance of a." << std::endl;
+    std::cout << "{m,n} denotes repetition. a{2,4} means 2 to 4 instances of a, a{2} exactly 2 and a{1,} 1 or more." << std::endl;
+    std::cout << "[] denotes a character class. [a-c] means one of a, b or c, and [^a] any character but a." << std::endl;
+    std::cout << "*, ? and {m,n} bind tighter than ., which binds tighter than +. a.b+c* means (a.b)+(c*)." << std::endl;
     std::cout << std::endl;
 
     try
@@ -680,11 +5245,18 @@ int main(){
         std::string args;
         std::cin >> args;
         FACompiler fac(args);
+        std::cout << "Null character is: " << fac.get_nullchar() << std::endl;
+        std::cout << "Alphabet allowed: " << fac.get_alphabet() << std::endl;
 
         std::cout << "\nEnter regex (+ denotes union, * denotes Kleene-closure, . denotes concatenation)" << std::endl;
         std::string regex;
         std::cin >> regex;
         FA fa = fac.compile(regex);
+        const FAStats &stats = fa.stats();
+        std::cout << "For input " << regex << " postfix notation is: " << fa.postfix() << std::endl;
+        std::cout << "Number of states in NFA " << stats.nfa_states << std::endl;
+        std::cout << "Number of states in DFA " << stats.dfa_states << std::endl;
+        std::cout << "Number of states in minimized DFA " << stats.min_dfa_states << std::endl;
 
         std::cout << "\nDFA Transition table for " << regex << std::endl;
         fa.print_transition_table();
@@ -692,16 +5264,16 @@ int main(){
         std::cout << "\nEnter number of test cases" << std::endl;
         int tc = 0;
         std::cin >> tc;
+        std::vector<int> trace;
         while(tc--){
             std::cout << "\nEnter string to check against regex" << std::endl;
             std::string test;
             std::cin >> test;
 
-            bool accepted = fa.check(test);
+            bool accepted = fa.trace(test, trace);
             if(accepted){
                 std::cout << test << " accepted!" << std::endl;
                 std::cout << "Trace of states" << std::endl;
-                std::vector<int> trace = fa.trace_states(test);
                 int sz = trace.size();
                 for(int i = 0; i<sz; i++){
                     if(i >= test.size()){